@@ -0,0 +1,253 @@
+#include "engine/Melody.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// micro benchmarks for every drawing primitive, runs headless on any platform
+// usage: Benchmark [--width w] [--height h] [--time ms] [--filter name] [--tiled threads] [--csv]
+
+using namespace Melody;
+
+enum Clip
+{
+	INSIDE,		// fully on screen
+	PARTIAL,	// straddling the left edge
+	OUTSIDE		// fully off screen
+};
+
+static const char* clip_names[] = { "inside", "partial", "outside" };
+static const char* mode_names[] = { "normal", "mask", "alpha" };
+
+struct Options
+{
+	int32_t width = 1280;
+	int32_t height = 720;
+	double time_ms = 50.0;
+	const char* filter = nullptr;
+	uint32_t tiled_threads = 0;
+	bool csv = false;
+};
+
+struct Bench
+{
+	const char* name;
+	bool sized;		// iterated over the shape sizes
+	// draws one shape of size s whose bounding box starts at (x, y)
+	void(*draw)(Engine& e, int32_t x, int32_t y, int32_t s, Pixel p, Sprite* sprite);
+};
+
+static Transform bench_transform(int32_t x, int32_t y, int32_t s)
+{
+	float half = s * 0.5f;
+	return Transform::translate(x + half, y + half) * Transform::rotate(0.5f) * Transform::scale(0.7f, 0.7f) * Transform::translate(-half, -half);
+}
+
+// the fill_triangle corners with a colour each and the sprite stretched across them
+static void bench_vertices(Vertex* v, int32_t x, int32_t y, int32_t s, Pixel p)
+{
+	v[0].x = (float)x;				v[0].y = (float)(y + s - 1);	v[0].u = 0.0f;	v[0].v = 1.0f;	v[0].color = p;
+	v[1].x = (float)(x + s / 2);	v[1].y = (float)y;				v[1].u = 0.5f;	v[1].v = 0.0f;	v[1].color = Pixel(p.g, p.b, p.r, p.a);
+	v[2].x = (float)(x + s - 1);	v[2].y = (float)(y + s - 1);	v[2].u = 1.0f;	v[2].v = 1.0f;	v[2].color = Pixel(p.b, p.r, p.g, p.a);
+}
+
+// a grid of 8 pixel cells filling the s * s box, two triangles a cell with the colour changing across it
+static void bench_mesh(Engine& e, int32_t x, int32_t y, int32_t s, Pixel p, Sprite* sprite)
+{
+	static std::vector<Vertex> vertices;
+	static std::vector<uint32_t> indices;
+	static int32_t built = 0;
+
+	uint32_t cells = (uint32_t)std::max(1, s / 8);
+	if (built != s)
+	{
+		vertices.clear();
+		indices.clear();
+		float size = (float)(s - 1) / cells;
+		for (uint32_t j = 0; j <= cells; j++)
+			for (uint32_t i = 0; i <= cells; i++)
+			{
+				Vertex v;
+				v.x = i * size;
+				v.y = j * size;
+				v.u = (float)i / cells;
+				v.v = (float)j / cells;
+				v.color = Pixel((uint8_t)(255 * i / cells), (uint8_t)(255 * j / cells), 128);
+				vertices.push_back(v);
+			}
+		for (uint32_t j = 0; j < cells; j++)
+			for (uint32_t i = 0; i < cells; i++)
+			{
+				uint32_t k = j * (cells + 1) + i;
+				uint32_t quad[6] = { k, k + 1, k + cells + 2, k, k + cells + 2, k + cells + 1 };
+				indices.insert(indices.end(), quad, quad + 6);
+			}
+		built = s;
+	}
+
+	e.draw_mesh(vertices.data(), (uint32_t)vertices.size(), indices.data(), (uint32_t)indices.size(), Transform::translate((float)x, (float)y));
+}
+
+// the benchmark sprite premultiplied, for the blend that skips weighing the source
+static void bench_premultiplied(Engine& e, int32_t x, int32_t y, int32_t s, Pixel p, Sprite* sprite)
+{
+	static Sprite copy;
+	if (copy._width != sprite->_width || copy._height != sprite->_height)
+	{
+		copy = Sprite(sprite->_width, sprite->_height);
+		for (int32_t j = 0; j < copy._height; j++)
+			std::copy_n(sprite->get_data() + j * sprite->get_stride(), copy._width, copy.get_data() + j * copy.get_stride());
+		copy.premultiply();
+	}
+
+	e.draw_sprite(x, y, &copy);
+}
+
+static const Bench benches[] =
+{
+	{ "draw_pixel", false, [](Engine& e, int32_t x, int32_t y, int32_t s, Pixel p, Sprite* sprite) { e.draw_pixel(x, y, p); } },
+	{ "draw_line", true, [](Engine& e, int32_t x, int32_t y, int32_t s, Pixel p, Sprite* sprite) { e.draw_line(x, y, x + s - 1, y + s / 3, p); } },
+	{ "draw_line_aa", true, [](Engine& e, int32_t x, int32_t y, int32_t s, Pixel p, Sprite* sprite) { e.draw_line_aa(x + 0.5f, y + 0.25f, x + s - 1.5f, y + s / 3 + 0.75f, p); } },
+	{ "draw_circle", true, [](Engine& e, int32_t x, int32_t y, int32_t s, Pixel p, Sprite* sprite) { e.draw_circle(x + s / 2, y + s / 2, s / 2, p); } },
+	{ "fill_circle", true, [](Engine& e, int32_t x, int32_t y, int32_t s, Pixel p, Sprite* sprite) { e.fill_circle(x + s / 2, y + s / 2, s / 2, p); } },
+	{ "fill_rect", true, [](Engine& e, int32_t x, int32_t y, int32_t s, Pixel p, Sprite* sprite) { e.fill_rect(x, y, s, s, p); } },
+	{ "draw_triangle", true, [](Engine& e, int32_t x, int32_t y, int32_t s, Pixel p, Sprite* sprite) { e.draw_triangle(x, y + s - 1, x + s / 2, y, x + s - 1, y + s - 1, p); } },
+	{ "fill_triangle", true, [](Engine& e, int32_t x, int32_t y, int32_t s, Pixel p, Sprite* sprite) { e.fill_triangle(x, y + s - 1, x + s / 2, y, x + s - 1, y + s - 1, p); } },
+	{ "fill_triangle_shaded", true, [](Engine& e, int32_t x, int32_t y, int32_t s, Pixel p, Sprite* sprite) { Vertex v[3]; bench_vertices(v, x, y, s, p); e.fill_triangle(v[0], v[1], v[2]); } },
+	{ "fill_triangle_textured", true, [](Engine& e, int32_t x, int32_t y, int32_t s, Pixel p, Sprite* sprite) { Vertex v[3]; bench_vertices(v, x, y, s, p); e.fill_triangle(v[0], v[1], v[2], sprite); } },
+	{ "draw_mesh", true, bench_mesh },
+	{ "draw_sprite", true, [](Engine& e, int32_t x, int32_t y, int32_t s, Pixel p, Sprite* sprite) { e.draw_sprite(x, y, sprite); } },
+	{ "draw_sprite_premultiplied", true, bench_premultiplied },
+	// the middle quarter drawn where it sits in the s * s box, so it straddles the edge like the others
+	{ "draw_sprite_partial", true, [](Engine& e, int32_t x, int32_t y, int32_t s, Pixel p, Sprite* sprite) { e.draw_sprite_partial(x + s / 4, y + s / 4, sprite, s / 4, s / 4, s / 2, s / 2); } },
+	{ "draw_sprite_resized", true, [](Engine& e, int32_t x, int32_t y, int32_t s, Pixel p, Sprite* sprite) { e.draw_sprite(x, y, sprite, s, s / 2, Sprite::FLIP_HORIZONTAL); } },
+	// rotated about the centre and shrunk to stay inside the s * s box
+	{ "draw_sprite_transformed", true, [](Engine& e, int32_t x, int32_t y, int32_t s, Pixel p, Sprite* sprite) { e.draw_sprite_transformed(sprite, bench_transform(x, y, s)); } },
+	{ "draw_sprite_transformed_bilinear", true, [](Engine& e, int32_t x, int32_t y, int32_t s, Pixel p, Sprite* sprite) { e.draw_sprite_transformed(sprite, bench_transform(x, y, s), Sprite::BILINEAR); } },
+};
+
+static const int32_t sizes[] = { 8, 64, 256 };
+
+static void clear(Engine& e)
+{
+	Sprite* screen = e.get_drawing_target();
+	for (int32_t y = 0; y < screen->_height; y++)
+		std::fill_n(screen->get_data() + y * screen->get_stride(), screen->_width, Pixel(0, 0, 0, 0));
+}
+
+// pixels one call writes in the mode under test, found by drawing it once onto a cleared screen.
+// mask mode skips the translucent sprite border, so it covers fewer pixels than the others
+static uint64_t covered_pixels(Engine& e, const Bench& b, int32_t x, int32_t y, int32_t s, Pixel p, Sprite* sprite)
+{
+	clear(e);
+	b.draw(e, x, y, s, p, sprite);
+	e.flush();
+
+	Sprite* screen = e.get_drawing_target();
+	uint64_t count = 0;
+	for (int32_t y = 0; y < screen->_height; y++)
+		for (int32_t x = 0; x < screen->_width; x++)
+			count += screen->get_pixel(x, y).n != 0;
+	return count;
+}
+
+static void run(Engine& e, const Options& o, const Bench& b, int32_t s, Clip clip, Pixel::Mode mode)
+{
+	int32_t x = 0, y = 0;
+	if (clip == INSIDE) { x = (o.width - s) / 2; y = (o.height - s) / 2; }
+	if (clip == PARTIAL) { x = -s / 2; y = (o.height - s) / 2; }
+	if (clip == OUTSIDE) { x = -s - 16; y = (o.height - s) / 2; }
+
+	// opaque sprite pixels with a translucent border, so every mode has work to do
+	Sprite sprite(s, s);
+	for (int32_t j = 0; j < s; j++)
+		for (int32_t i = 0; i < s; i++)
+		{
+			bool edge = i < s / 8 || j < s / 8 || i >= s - s / 8 || j >= s - s / 8;
+			sprite.set_pixel(i, j, Pixel(i * 255 / s, j * 255 / s, 128, edge ? 128 : 255));
+		}
+
+	Pixel p = mode == Pixel::Mode::ALPHA ? Pixel(200, 100, 50, 128) : Pixel(200, 100, 50, 255);
+	e.set_pixel_mode(mode);
+
+	uint64_t pixels = covered_pixels(e, b, x, y, s, p, &sprite);
+
+	// grow the batch until it takes long enough to time reliably
+	uint64_t calls = 0;
+	double elapsed = 0.0;
+	for (uint64_t batch = 16; elapsed < o.time_ms * 1e-3; batch *= 2)
+	{
+		auto t0 = std::chrono::steady_clock::now();
+		for (uint64_t i = 0; i < batch; i++)
+			b.draw(e, x, y, s, p, &sprite);
+		e.flush();
+		elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		calls += batch;
+	}
+
+	double ns_per_call = elapsed * 1e9 / (double)calls;
+	double mpix_per_s = (double)pixels * (double)calls / elapsed * 1e-6;
+
+	if (o.csv)
+		printf("%s,%d,%s,%s,%llu,%.2f,%.2f\n", b.name, b.sized ? s : 1, clip_names[clip], mode_names[mode],
+			(unsigned long long)pixels, ns_per_call, mpix_per_s);
+	else
+		printf("%-20s %5d %-8s %-7s %9llu %12.2f %12.2f\n", b.name, b.sized ? s : 1, clip_names[clip], mode_names[mode],
+			(unsigned long long)pixels, ns_per_call, mpix_per_s);
+}
+
+int main(int argc, char** argv)
+{
+	Options o;
+	for (int i = 1; i < argc; i++)
+	{
+		bool has_value = i + 1 < argc;
+		if (!strcmp(argv[i], "--width") && has_value) o.width = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--height") && has_value) o.height = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--time") && has_value) o.time_ms = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--filter") && has_value) o.filter = argv[++i];
+		else if (!strcmp(argv[i], "--tiled") && has_value) o.tiled_threads = (uint32_t)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--csv")) o.csv = true;
+		else
+		{
+			printf("usage: %s [--width w] [--height h] [--time ms] [--filter name] [--tiled threads] [--csv]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	Engine e;
+	e._app_name = "Benchmark";
+	if (!e.construct(o.width, o.height, 1, 1))
+		return 1;
+	if (o.tiled_threads)
+		e.set_tiled_rendering(true, o.tiled_threads);
+
+	if (o.csv)
+		printf("primitive,size,clip,mode,pixels_per_call,ns_per_call,mpixels_per_s\n");
+	else
+		printf("%-20s %5s %-8s %-7s %9s %12s %12s\n", "primitive", "size", "clip", "mode", "pixels", "ns/call", "Mpixels/s");
+
+	for (const Bench& b : benches)
+	{
+		if (o.filter && !strstr(b.name, o.filter))
+			continue;
+
+		for (int32_t s : sizes)
+		{
+			for (int clip = INSIDE; clip <= OUTSIDE; clip++)
+			{
+				// a single point can't straddle the edge
+				if (clip == PARTIAL && !b.sized)
+					continue;
+
+				for (int mode = Pixel::Mode::NORMAL; mode <= Pixel::Mode::ALPHA; mode++)
+					run(e, o, b, s, (Clip)clip, (Pixel::Mode)mode);
+			}
+
+			if (!b.sized)
+				break;
+		}
+	}
+
+	return 0;
+}
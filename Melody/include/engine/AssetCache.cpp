@@ -0,0 +1,253 @@
+#include "AssetCache.h"
+
+namespace Melody
+{
+	AssetCache::AssetCache(size_t memory_budget, uint32_t thread_count)
+	{
+		_memory_budget = memory_budget;
+
+		// leave a hardware thread for the game loop
+		if (thread_count == 0)
+			thread_count = std::max(2u, std::thread::hardware_concurrency()) - 1;
+		for (uint32_t i = 0; i < thread_count; i++)
+			_workers.emplace_back(&AssetCache::worker, this);
+	}
+
+	AssetCache::~AssetCache()
+	{
+		std::deque<Job> dropped;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_quit = true;
+			dropped.swap(_jobs);
+		}
+		_signal.notify_all();
+		for (auto& t : _workers)
+			t.join();
+
+		// anyone still waiting on a queued file gets nullptr rather than a broken promise
+		for (auto& job : dropped)
+			job.promise.set_value(nullptr);
+	}
+
+	std::shared_future<std::shared_ptr<Sprite>> AssetCache::load_async(const std::string& file)
+	{
+		std::shared_future<std::shared_ptr<Sprite>> future;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			bool created;
+			Entry& e = touch(file, created);
+			future = e.future;
+			if (!created)
+				return future;
+		}
+
+		// touch queued the file, wake a worker for it
+		_signal.notify_one();
+		return future;
+	}
+
+	std::shared_ptr<Sprite> AssetCache::load(const std::string& file)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		bool created;
+		Entry& e = touch(file, created);
+		std::shared_future<std::shared_ptr<Sprite>> future = e.future;
+
+		// take the job back if no worker has picked it up, waiting in line would only add latency
+		for (auto it = _jobs.begin(); it != _jobs.end(); ++it)
+		{
+			if (it->file == file)
+			{
+				Job job = std::move(*it);
+				_jobs.erase(it);
+				lock.unlock();
+				run(job);
+				break;
+			}
+		}
+
+		if (lock.owns_lock())
+			lock.unlock();
+		return future.get();
+	}
+
+	std::shared_ptr<Sprite> AssetCache::get_if_ready(const std::string& file)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		auto it = _entries.find(file);
+		if (it == _entries.end() || !it->second.ready)
+			return nullptr;
+
+		_lru.splice(_lru.begin(), _lru, it->second.lru);
+		trim();
+		return it->second.future.get();
+	}
+
+	bool AssetCache::is_ready(const std::string& file) const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		auto it = _entries.find(file);
+		return it != _entries.end() && it->second.ready;
+	}
+
+	void AssetCache::set_memory_budget(size_t bytes)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_memory_budget = bytes;
+		trim();
+	}
+
+	size_t AssetCache::get_memory_budget() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _memory_budget;
+	}
+
+	size_t AssetCache::get_memory_usage() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _memory_usage;
+	}
+
+	uint32_t AssetCache::get_pending_count() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _pending;
+	}
+
+	void AssetCache::evict(const std::string& file)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		auto it = _entries.find(file);
+
+		// files still loading stay, their worker reports back to the entry
+		if (it == _entries.end() || !it->second.ready)
+			return;
+
+		_memory_usage -= it->second.bytes;
+		_lru.erase(it->second.lru);
+		_entries.erase(it);
+	}
+
+	void AssetCache::clear()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (auto it = _entries.begin(); it != _entries.end();)
+		{
+			if (it->second.ready)
+			{
+				_memory_usage -= it->second.bytes;
+				_lru.erase(it->second.lru);
+				it = _entries.erase(it);
+			}
+			else
+				++it;
+		}
+	}
+
+	AssetCache::Entry& AssetCache::touch(const std::string& file, bool& created)
+	{
+		auto it = _entries.find(file);
+		created = it == _entries.end();
+		if (!created)
+		{
+			// a hit moves the file to the front where trim leaves it, and gives sprites released since the
+			// last load a chance to go
+			_lru.splice(_lru.begin(), _lru, it->second.lru);
+			trim();
+			return it->second;
+		}
+
+		// new files get an entry straight away so later requests share the same load
+		Job job;
+		job.file = file;
+
+		Entry& e = _entries[file];
+		e.future = job.promise.get_future().share();
+		_lru.push_front(file);
+		e.lru = _lru.begin();
+
+		_jobs.push_back(std::move(job));
+		_pending++;
+		return e;
+	}
+
+	void AssetCache::trim()
+	{
+		if (_memory_budget == 0)
+			return;
+
+		// walk from the least recently used end, skipping sprites someone still holds
+		// the most recent one always stays, it may be on its way to a caller
+		auto it = _lru.end();
+		while (_memory_usage > _memory_budget && it != _lru.begin())
+		{
+			if (--it == _lru.begin())
+				break;
+
+			auto entry = _entries.find(*it);
+			if (!entry->second.ready || entry->second.future.get().use_count() > 1)
+				continue;
+
+			_memory_usage -= entry->second.bytes;
+			_entries.erase(entry);
+			it = _lru.erase(it);
+		}
+	}
+
+	void AssetCache::run(Job& job)
+	{
+		MELODY_ZONE("load asset");
+
+		std::shared_ptr<Sprite> sprite = std::make_shared<Sprite>();
+		if (sprite->load_from_file(job.file) != ReturnCode::OK)
+			sprite = nullptr;
+
+		if (!sprite)
+		{
+			// failures are not cached, a later request tries the file again
+			std::lock_guard<std::mutex> lock(_mutex);
+			auto it = _entries.find(job.file);
+			_lru.erase(it->second.lru);
+			_entries.erase(it);
+			_pending--;
+		}
+
+		job.promise.set_value(sprite);
+		if (!sprite)
+			return;
+
+		// only counted once the promise holds the sprite, so trim sees the real handle count
+		std::lock_guard<std::mutex> lock(_mutex);
+		auto it = _entries.find(job.file);
+		it->second.ready = true;
+		it->second.bytes = (size_t)sprite->get_stride() * sprite->_height * sizeof(Pixel);
+		_memory_usage += it->second.bytes;
+		_pending--;
+
+		// drop our own handle first or the new sprite could never be trimmed
+		sprite = nullptr;
+		trim();
+	}
+
+	void AssetCache::worker()
+	{
+		MELODY_THREAD_NAME("asset loader");
+
+		while (true)
+		{
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_signal.wait(lock, [this] { return _quit || !_jobs.empty(); });
+				if (_quit)
+					return;
+
+				job = std::move(_jobs.front());
+				_jobs.pop_front();
+			}
+			run(job);
+		}
+	}
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "Melody.h"
+
+#include <future>
+#include <memory>
+
+namespace Melody
+{
+	// sprites keyed by file path, each file is decoded once and shared by everyone who asks for it
+	class AssetCache
+	{
+	public:
+		// budget in bytes of pixel data, 0 for no limit
+		// thread_count background loaders, 0 for one less than the hardware threads
+		AssetCache(size_t memory_budget = 0, uint32_t thread_count = 0);
+		~AssetCache();
+
+		AssetCache(const AssetCache&) = delete;
+		AssetCache& operator=(const AssetCache&) = delete;
+
+	public:
+		// queues the file on a background thread if it is not cached yet, never blocks
+		// the future holds nullptr if the file could not be loaded
+		std::shared_future<std::shared_ptr<Sprite>> load_async(const std::string& file);
+		// returns the sprite, decoding it on the calling thread if nobody has started on it yet
+		std::shared_ptr<Sprite> load(const std::string& file);
+		// nullptr until the file has finished loading
+		std::shared_ptr<Sprite> get_if_ready(const std::string& file);
+		bool is_ready(const std::string& file) const;
+
+	public:
+		// least recently used sprites nobody else holds are dropped until usage fits the budget.
+		// checked when a load finishes, when a cached file is asked for again and when the budget changes
+		void set_memory_budget(size_t bytes);
+		size_t get_memory_budget() const;
+		size_t get_memory_usage() const;
+		uint32_t get_pending_count() const;
+
+		// forget loaded sprites, handles already given out stay valid
+		void evict(const std::string& file);
+		void clear();
+
+	private:
+		struct Entry
+		{
+			std::shared_future<std::shared_ptr<Sprite>> future;
+			bool ready = false;
+			size_t bytes = 0;
+			std::list<std::string>::iterator lru;
+		};
+
+		struct Job
+		{
+			std::string file;
+			std::promise<std::shared_ptr<Sprite>> promise;
+		};
+
+	private:
+		// both expect _mutex to be held
+		Entry& touch(const std::string& file, bool& created);
+		void trim();
+
+		void run(Job& job);
+		void worker();
+
+	private:
+		std::map<std::string, Entry> _entries;
+		std::list<std::string> _lru; // most recently used first
+		std::deque<Job> _jobs;
+
+		size_t _memory_budget = 0;
+		size_t _memory_usage = 0;
+		uint32_t _pending = 0;
+
+		mutable std::mutex _mutex;
+		std::condition_variable _signal;
+		std::vector<std::thread> _workers;
+		bool _quit = false;
+	};
+}
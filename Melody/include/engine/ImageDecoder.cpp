@@ -0,0 +1,907 @@
+#include "ImageDecoder.h"
+
+namespace Melody
+{
+	namespace ImageDecoder
+	{
+		// images at least this big are converted on several threads
+		static const int64_t PARALLEL_PIXELS = 1 << 20;
+
+		// largest image accepted, keeps width * height * 4 well inside size_t on 32 bit builds
+		static const int64_t MAX_PIXELS = 1 << 28;
+
+		static inline uint16_t read_le16(const uint8_t* p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+		static inline uint32_t read_le32(const uint8_t* p) { return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24); }
+		static inline uint32_t read_be32(const uint8_t* p) { return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3]; }
+
+		// runs fn(y_begin, y_end) over horizontal strips, on the calling thread for small images
+		template<typename F>
+		static void parallel_rows(int32_t width, int32_t height, F fn)
+		{
+			uint32_t threads = 1;
+			if ((int64_t)width * height >= PARALLEL_PIXELS)
+				threads = std::min(std::max(1u, std::thread::hardware_concurrency()), (uint32_t)height);
+
+			if (threads <= 1)
+			{
+				fn(0, height);
+				return;
+			}
+
+			int32_t strip = (height + (int32_t)threads - 1) / (int32_t)threads;
+			std::vector<std::thread> pool;
+			for (int32_t y = strip; y < height; y += strip)
+				pool.emplace_back(fn, y, std::min(y + strip, height));
+			fn(0, std::min(strip, height));
+
+			for (auto& t : pool)
+				t.join();
+		}
+
+		static bool valid_size(int64_t width, int64_t height)
+		{
+			return width > 0 && height > 0 && width <= MAX_PIXELS && height <= MAX_PIXELS && width * height <= MAX_PIXELS;
+		}
+
+		// bmp
+
+		struct BmpInfo
+		{
+			int32_t width = 0;
+			int32_t height = 0;
+			bool top_down = false;
+			uint32_t bpp = 0;
+			uint32_t compression = 0;
+			uint32_t offset = 0;
+			uint32_t masks[4] = { 0, 0, 0, 0 }; // r, g, b, a
+			const uint8_t* palette = nullptr;
+			uint32_t palette_entry = 4;
+			uint32_t palette_count = 0;
+		};
+
+		static bool bmp_info(const uint8_t* data, size_t size, BmpInfo& info)
+		{
+			if (size < 26 || data[0] != 'B' || data[1] != 'M')
+				return false;
+
+			info.offset = read_le32(data + 10);
+			uint32_t header = read_le32(data + 14);
+			if (size < 14 + (size_t)header || header < 12)
+				return false;
+
+			const uint8_t* dib = data + 14;
+			int64_t height;
+			if (header == 12)
+			{
+				// os/2 core header, 3 byte palette entries
+				info.width = read_le16(dib + 4);
+				height = (int16_t)read_le16(dib + 6);
+				info.bpp = read_le16(dib + 10);
+				info.palette_entry = 3;
+			}
+			else
+			{
+				if (header < 40)
+					return false;
+				info.width = (int32_t)read_le32(dib + 4);
+				height = (int32_t)read_le32(dib + 8);
+				info.bpp = read_le16(dib + 14);
+				info.compression = read_le32(dib + 16);
+				info.palette_count = read_le32(dib + 32);
+
+				// BI_BITFIELDS masks follow a 40 byte header, larger headers carry them inline
+				if (info.compression == 3 || info.compression == 6)
+				{
+					const uint8_t* m = dib + 40;
+					uint32_t count = info.compression == 6 ? 4 : 3;
+					if (header >= 52)
+						count = header >= 56 ? 4 : 3;
+					if (14 + 40 + (size_t)count * 4 > size)
+						return false;
+					for (uint32_t i = 0; i < count; i++)
+						info.masks[i] = read_le32(m + i * 4);
+				}
+			}
+
+			info.top_down = height < 0;
+			info.height = (int32_t)(height < 0 ? -height : height);
+
+			if (info.bpp <= 8)
+			{
+				if (info.palette_count == 0 || info.palette_count > (1u << info.bpp))
+					info.palette_count = 1u << info.bpp;
+				size_t palette_offset = 14 + (size_t)header + (info.compression == 3 && header == 40 ? 12 : 0);
+				if (palette_offset + (size_t)info.palette_count * info.palette_entry > size)
+					return false;
+				info.palette = data + palette_offset;
+			}
+			else
+				info.palette_count = 0;
+
+			return valid_size(info.width, info.height);
+		}
+
+		static inline uint8_t mask_channel(uint32_t v, uint32_t mask)
+		{
+			if (!mask)
+				return 0;
+
+			// shift the field down and scale it to 8 bits
+			uint32_t shift = 0;
+			while (!((mask >> shift) & 1))
+				shift++;
+			uint32_t bits = 0;
+			while (shift + bits < 32 && ((mask >> (shift + bits)) & 1))
+				bits++;
+
+			uint32_t c = (v & mask) >> shift;
+			uint32_t max = bits >= 32 ? 0xFFFFFFFFu : (1u << bits) - 1;
+			return (uint8_t)((uint64_t)c * 255 / max);
+		}
+
+		static bool bmp_decode(const uint8_t* data, size_t size, Pixel* pixels, int32_t stride)
+		{
+			BmpInfo info;
+			if (!bmp_info(data, size, info))
+				return false;
+
+			// rle and embedded jpeg or png are left to the platform loader
+			bool bitfields = info.compression == 3 || info.compression == 6;
+			if (info.compression != 0 && !bitfields)
+				return false;
+			if (info.bpp != 1 && info.bpp != 4 && info.bpp != 8 && info.bpp != 16 && info.bpp != 24 && info.bpp != 32)
+				return false;
+
+			size_t row_bytes = (((size_t)info.width * info.bpp + 31) / 32) * 4;
+			if ((size_t)info.offset + row_bytes * info.height > size)
+				return false;
+
+			// uncompressed 16 and 32 bit images default to 555 and 888 without alpha
+			uint32_t masks[4] = { info.masks[0], info.masks[1], info.masks[2], info.masks[3] };
+			if (!bitfields && info.bpp == 16) { masks[0] = 0x7C00; masks[1] = 0x03E0; masks[2] = 0x001F; masks[3] = 0; }
+			if (!bitfields && info.bpp == 32) { masks[0] = 0x00FF0000; masks[1] = 0x0000FF00; masks[2] = 0x000000FF; masks[3] = 0; }
+			bool fast32 = info.bpp == 32 && masks[0] == 0x00FF0000 && masks[1] == 0x0000FF00 && masks[2] == 0x000000FF;
+
+			Pixel palette[256];
+			for (uint32_t i = 0; i < info.palette_count; i++)
+			{
+				const uint8_t* e = info.palette + i * info.palette_entry;
+				palette[i] = Pixel(e[2], e[1], e[0]);
+			}
+
+			// every row is independent, so strips convert in parallel
+			parallel_rows(info.width, info.height, [&](int32_t y_begin, int32_t y_end)
+			{
+				for (int32_t y = y_begin; y < y_end; y++)
+				{
+					int32_t file_row = info.top_down ? y : info.height - 1 - y;
+					const uint8_t* src = data + info.offset + file_row * row_bytes;
+					Pixel* dst = pixels + (size_t)y * stride;
+
+					switch (info.bpp)
+					{
+					case 1:
+					case 4:
+					case 8:
+					{
+						uint32_t per_byte = 8 / info.bpp;
+						uint32_t index_mask = (1u << info.bpp) - 1;
+						for (int32_t x = 0; x < info.width; x++)
+						{
+							uint32_t shift = 8 - info.bpp * (1 + x % per_byte);
+							uint32_t index = (src[x / per_byte] >> shift) & index_mask;
+							dst[x] = index < info.palette_count ? palette[index] : Pixel();
+						}
+						break;
+					}
+					case 24:
+						for (int32_t x = 0; x < info.width; x++, src += 3)
+							dst[x] = Pixel(src[2], src[1], src[0]);
+						break;
+					case 16:
+					case 32:
+						if (fast32)
+						{
+							for (int32_t x = 0; x < info.width; x++, src += 4)
+								dst[x] = Pixel(src[2], src[1], src[0], masks[3] == 0xFF000000 ? src[3] : 255);
+							break;
+						}
+						for (int32_t x = 0; x < info.width; x++)
+						{
+							uint32_t v = info.bpp == 16 ? read_le16(src + x * 2) : read_le32(src + x * 4);
+							dst[x] = Pixel(mask_channel(v, masks[0]), mask_channel(v, masks[1]), mask_channel(v, masks[2]),
+								masks[3] ? mask_channel(v, masks[3]) : 255);
+						}
+						break;
+					}
+				}
+			});
+
+			return true;
+		}
+
+		// inflate, zlib wrapped deflate streams as used by png
+
+		struct BitReader
+		{
+			const uint8_t* p;
+			const uint8_t* end;
+			uint64_t buffer = 0;
+			int32_t count = 0;
+			uint32_t overrun = 0; // zero bytes fed past the end
+
+			BitReader(const uint8_t* data, size_t size) : p(data), end(data + size) {}
+
+			void fill()
+			{
+				while (count <= 56)
+				{
+					uint64_t b = 0;
+					if (p < end)
+						b = *p++;
+					else
+						overrun++;
+					buffer |= b << count;
+					count += 8;
+				}
+			}
+
+			uint32_t peek(int32_t n)
+			{
+				if (count < n)
+					fill();
+				return (uint32_t)(buffer & ((1ull << n) - 1));
+			}
+
+			void consume(int32_t n)
+			{
+				buffer >>= n;
+				count -= n;
+			}
+
+			uint32_t bits(int32_t n)
+			{
+				uint32_t v = peek(n);
+				consume(n);
+				return v;
+			}
+
+			// a valid stream never needs more padding than the bit buffer holds
+			bool corrupt() const
+			{
+				return overrun > 8;
+			}
+		};
+
+		struct Huffman
+		{
+			static const int32_t FAST_BITS = 10;
+
+			uint16_t fast[1 << FAST_BITS]; // symbol << 4 | length, 0 when the code is longer
+			uint16_t counts[16];
+			uint16_t symbols[288];
+
+			bool build(const uint8_t* lengths, int32_t n)
+			{
+				memset(fast, 0, sizeof(fast));
+				memset(counts, 0, sizeof(counts));
+				for (int32_t i = 0; i < n; i++)
+					counts[lengths[i]]++;
+				counts[0] = 0;
+
+				// reject over-subscribed code sets, incomplete ones are legal
+				int32_t left = 1;
+				for (int32_t len = 1; len < 16; len++)
+				{
+					left = (left << 1) - counts[len];
+					if (left < 0)
+						return false;
+				}
+
+				uint16_t offsets[16];
+				uint32_t next_code[16];
+				offsets[1] = 0;
+				next_code[1] = 0;
+				for (int32_t len = 1; len < 15; len++)
+				{
+					offsets[len + 1] = offsets[len] + counts[len];
+					next_code[len + 1] = (next_code[len] + counts[len]) << 1;
+				}
+
+				for (int32_t i = 0; i < n; i++)
+				{
+					int32_t len = lengths[i];
+					if (!len)
+						continue;
+
+					symbols[offsets[len]++] = (uint16_t)i;
+					uint32_t code = next_code[len]++;
+					if (len > FAST_BITS)
+						continue;
+
+					// the stream sends codes msb first, the bit reader works lsb first
+					uint32_t reversed = 0;
+					for (int32_t b = 0; b < len; b++)
+						reversed |= ((code >> b) & 1) << (len - 1 - b);
+					for (uint32_t k = reversed; k < (1u << FAST_BITS); k += 1u << len)
+						fast[k] = (uint16_t)((i << 4) | len);
+				}
+
+				return true;
+			}
+
+			int32_t decode(BitReader& br) const
+			{
+				uint16_t e = fast[br.peek(16) & ((1 << FAST_BITS) - 1)];
+				if (e)
+				{
+					br.consume(e & 15);
+					return e >> 4;
+				}
+
+				// canonical decode one bit at a time for the long codes
+				int32_t code = 0, first = 0, index = 0;
+				for (int32_t len = 1; len < 16; len++)
+				{
+					code |= (int32_t)br.bits(1);
+					int32_t count = counts[len];
+					if (code - first < count)
+						return symbols[index + (code - first)];
+					index += count;
+					first = (first + count) << 1;
+					code <<= 1;
+				}
+				return -1;
+			}
+		};
+
+		static const uint16_t length_base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+		static const uint8_t length_extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+		static const uint16_t dist_base[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+		static const uint8_t dist_extra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+		static const uint8_t code_length_order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+		static bool inflate_block(BitReader& br, const Huffman& lit, const Huffman& dist, std::vector<uint8_t>& out, size_t limit)
+		{
+			while (true)
+			{
+				int32_t sym = lit.decode(br);
+				if (sym < 0 || br.corrupt())
+					return false;
+
+				if (sym < 256)
+				{
+					if (out.size() >= limit)
+						return false;
+					out.push_back((uint8_t)sym);
+					continue;
+				}
+
+				if (sym == 256)
+					return true;
+
+				sym -= 257;
+				if (sym >= 29)
+					return false;
+				size_t len = length_base[sym] + br.bits(length_extra[sym]);
+
+				int32_t dsym = dist.decode(br);
+				if (dsym < 0 || dsym >= 30)
+					return false;
+				size_t d = dist_base[dsym] + br.bits(dist_extra[dsym]);
+				if (d > out.size() || out.size() + len > limit)
+					return false;
+
+				// byte by byte, the source may overlap what is being written
+				size_t from = out.size() - d;
+				for (size_t i = 0; i < len; i++)
+					out.push_back(out[from + i]);
+			}
+		}
+
+		static bool inflate_zlib(const uint8_t* data, size_t size, std::vector<uint8_t>& out, size_t limit)
+		{
+			if (size < 2)
+				return false;
+
+			uint32_t cmf = data[0], flg = data[1];
+			if ((cmf & 15) != 8 || ((cmf << 8) | flg) % 31 != 0 || (flg & 32))
+				return false;
+
+			out.clear();
+			out.reserve(limit);
+			BitReader br(data + 2, size - 2);
+
+			Huffman lit, dist;
+			bool final_block = false;
+			while (!final_block)
+			{
+				final_block = br.bits(1) != 0;
+				uint32_t type = br.bits(2);
+
+				if (type == 0)
+				{
+					// stored, realign to the next byte
+					br.consume(br.count & 7);
+					uint32_t len = br.bits(16);
+					uint32_t nlen = br.bits(16);
+					if ((len ^ 0xFFFF) != nlen || out.size() + len > limit)
+						return false;
+					for (uint32_t i = 0; i < len; i++)
+						out.push_back((uint8_t)br.bits(8));
+				}
+				else if (type == 1)
+				{
+					uint8_t lengths[288 + 30];
+					memset(lengths, 8, 144);
+					memset(lengths + 144, 9, 112);
+					memset(lengths + 256, 7, 24);
+					memset(lengths + 280, 8, 8);
+					memset(lengths + 288, 5, 30);
+					if (!lit.build(lengths, 288) || !dist.build(lengths + 288, 30))
+						return false;
+					if (!inflate_block(br, lit, dist, out, limit))
+						return false;
+				}
+				else if (type == 2)
+				{
+					uint32_t hlit = br.bits(5) + 257;
+					uint32_t hdist = br.bits(5) + 1;
+					uint32_t hclen = br.bits(4) + 4;
+
+					uint8_t code_lengths[19] = { 0 };
+					for (uint32_t i = 0; i < hclen; i++)
+						code_lengths[code_length_order[i]] = (uint8_t)br.bits(3);
+
+					Huffman lengths_code;
+					if (!lengths_code.build(code_lengths, 19))
+						return false;
+
+					// literal and distance lengths share one run length coded sequence
+					uint8_t lengths[288 + 32] = { 0 };
+					uint32_t n = 0;
+					while (n < hlit + hdist)
+					{
+						int32_t sym = lengths_code.decode(br);
+						if (sym < 0 || br.corrupt())
+							return false;
+
+						if (sym < 16)
+						{
+							lengths[n++] = (uint8_t)sym;
+							continue;
+						}
+
+						uint8_t value = 0;
+						uint32_t repeat;
+						if (sym == 16)
+						{
+							if (n == 0)
+								return false;
+							value = lengths[n - 1];
+							repeat = 3 + br.bits(2);
+						}
+						else if (sym == 17)
+							repeat = 3 + br.bits(3);
+						else
+							repeat = 11 + br.bits(7);
+
+						if (n + repeat > hlit + hdist)
+							return false;
+						while (repeat--)
+							lengths[n++] = value;
+					}
+
+					if (!lit.build(lengths, hlit) || !dist.build(lengths + hlit, hdist))
+						return false;
+					if (!inflate_block(br, lit, dist, out, limit))
+						return false;
+				}
+				else
+					return false;
+
+				if (br.corrupt())
+					return false;
+			}
+
+			return true;
+		}
+
+		// png
+
+		struct PngInfo
+		{
+			int32_t width = 0;
+			int32_t height = 0;
+			uint32_t depth = 0;
+			uint32_t color = 0;
+			uint32_t interlace = 0;
+			uint32_t channels = 0;
+
+			Pixel palette[256];
+			uint32_t palette_count = 0;
+			bool has_key = false;
+			uint16_t key[3] = { 0, 0, 0 }; // transparent grey or rgb sample
+
+			std::vector<uint8_t> idat;
+		};
+
+		static const uint8_t png_signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+
+		static bool png_header(const uint8_t* data, size_t size, PngInfo& info)
+		{
+			if (size < 33 || memcmp(data, png_signature, 8) != 0 || memcmp(data + 12, "IHDR", 4) != 0)
+				return false;
+
+			const uint8_t* h = data + 16;
+			info.width = (int32_t)read_be32(h);
+			info.height = (int32_t)read_be32(h + 4);
+			info.depth = h[8];
+			info.color = h[9];
+			info.interlace = h[12];
+			if (h[10] != 0 || h[11] != 0 || info.interlace > 1)
+				return false;
+
+			switch (info.color)
+			{
+			case 0: info.channels = 1; break;
+			case 2: info.channels = 3; break;
+			case 3: info.channels = 1; break;
+			case 4: info.channels = 2; break;
+			case 6: info.channels = 4; break;
+			default: return false;
+			}
+
+			bool depth_ok = info.depth == 8 || info.depth == 16;
+			if (info.color == 0)
+				depth_ok = depth_ok || info.depth == 1 || info.depth == 2 || info.depth == 4;
+			if (info.color == 3)
+				depth_ok = info.depth == 1 || info.depth == 2 || info.depth == 4 || info.depth == 8;
+			if (!depth_ok)
+				return false;
+
+			return (int32_t)read_be32(h) > 0 && (int32_t)read_be32(h + 4) > 0 && valid_size(info.width, info.height);
+		}
+
+		static bool png_chunks(const uint8_t* data, size_t size, PngInfo& info)
+		{
+			size_t pos = 8;
+			while (pos + 12 <= size)
+			{
+				uint32_t len = read_be32(data + pos);
+				const uint8_t* type = data + pos + 4;
+				const uint8_t* body = data + pos + 8;
+				if (len > size - pos - 12)
+					return false;
+
+				if (!memcmp(type, "PLTE", 4))
+				{
+					info.palette_count = std::min(len / 3, 256u);
+					for (uint32_t i = 0; i < info.palette_count; i++)
+						info.palette[i] = Pixel(body[i * 3], body[i * 3 + 1], body[i * 3 + 2]);
+				}
+				else if (!memcmp(type, "tRNS", 4))
+				{
+					if (info.color == 3)
+					{
+						for (uint32_t i = 0; i < len && i < info.palette_count; i++)
+							info.palette[i].a = body[i];
+					}
+					else if (info.color == 0 && len >= 2)
+					{
+						info.has_key = true;
+						info.key[0] = (uint16_t)((body[0] << 8) | body[1]);
+					}
+					else if (info.color == 2 && len >= 6)
+					{
+						info.has_key = true;
+						for (int32_t i = 0; i < 3; i++)
+							info.key[i] = (uint16_t)((body[i * 2] << 8) | body[i * 2 + 1]);
+					}
+				}
+				else if (!memcmp(type, "IDAT", 4))
+					info.idat.insert(info.idat.end(), body, body + len);
+				else if (!memcmp(type, "IEND", 4))
+					return true;
+
+				pos += 12 + (size_t)len;
+			}
+
+			return !info.idat.empty();
+		}
+
+		static inline uint8_t paeth(uint8_t a, uint8_t b, uint8_t c)
+		{
+			int32_t p = (int32_t)a + b - c;
+			int32_t pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+			if (pa <= pb && pa <= pc) return a;
+			if (pb <= pc) return b;
+			return c;
+		}
+
+		// undoes the per row filters in place, rows are 1 filter byte followed by row_bytes
+		static bool png_unfilter(uint8_t* rows, int32_t height, size_t row_bytes, size_t bpp)
+		{
+			const uint8_t* prev = nullptr;
+			for (int32_t y = 0; y < height; y++)
+			{
+				uint8_t* row = rows + y * (row_bytes + 1);
+				uint8_t filter = row[0];
+				uint8_t* cur = row + 1;
+
+				switch (filter)
+				{
+				case 0:
+					break;
+				case 1:
+					for (size_t i = bpp; i < row_bytes; i++)
+						cur[i] = (uint8_t)(cur[i] + cur[i - bpp]);
+					break;
+				case 2:
+					if (prev)
+						for (size_t i = 0; i < row_bytes; i++)
+							cur[i] = (uint8_t)(cur[i] + prev[i]);
+					break;
+				case 3:
+					for (size_t i = 0; i < row_bytes; i++)
+					{
+						uint32_t left = i >= bpp ? cur[i - bpp] : 0;
+						uint32_t up = prev ? prev[i] : 0;
+						cur[i] = (uint8_t)(cur[i] + ((left + up) >> 1));
+					}
+					break;
+				case 4:
+					for (size_t i = 0; i < row_bytes; i++)
+					{
+						uint8_t left = i >= bpp ? cur[i - bpp] : 0;
+						uint8_t up = prev ? prev[i] : 0;
+						uint8_t up_left = prev && i >= bpp ? prev[i - bpp] : 0;
+						cur[i] = (uint8_t)(cur[i] + paeth(left, up, up_left));
+					}
+					break;
+				default:
+					return false;
+				}
+
+				prev = cur;
+			}
+			return true;
+		}
+
+		// converts one unfiltered row to pixels, writing every step-th pixel of dst
+		static void png_convert_row(const PngInfo& info, const uint8_t* src, int32_t width, Pixel* dst, int32_t step)
+		{
+			uint32_t depth = info.depth;
+
+			auto sample = [&](int32_t index) -> uint32_t
+			{
+				if (depth == 8) return src[index];
+				if (depth == 16) return (uint32_t)((src[index * 2] << 8) | src[index * 2 + 1]);
+				uint32_t bit = (uint32_t)index * depth;
+				return (src[bit >> 3] >> (8 - depth - (bit & 7))) & ((1u << depth) - 1);
+			};
+
+			// scales a sample to 8 bits
+			auto scale = [&](uint32_t v) -> uint8_t
+			{
+				if (depth == 8) return (uint8_t)v;
+				if (depth == 16) return (uint8_t)(v >> 8);
+				return (uint8_t)(v * 255 / ((1u << depth) - 1));
+			};
+
+			for (int32_t x = 0; x < width; x++, dst += step)
+			{
+				switch (info.color)
+				{
+				case 0:
+				{
+					uint32_t v = sample(x);
+					uint8_t g = scale(v);
+					*dst = Pixel(g, g, g, info.has_key && v == info.key[0] ? 0 : 255);
+					break;
+				}
+				case 2:
+				{
+					uint32_t r = sample(x * 3), g = sample(x * 3 + 1), b = sample(x * 3 + 2);
+					bool key = info.has_key && r == info.key[0] && g == info.key[1] && b == info.key[2];
+					*dst = Pixel(scale(r), scale(g), scale(b), key ? 0 : 255);
+					break;
+				}
+				case 3:
+				{
+					uint32_t index = sample(x);
+					*dst = index < info.palette_count ? info.palette[index] : Pixel(0, 0, 0, 255);
+					break;
+				}
+				case 4:
+				{
+					uint8_t g = scale(sample(x * 2));
+					*dst = Pixel(g, g, g, scale(sample(x * 2 + 1)));
+					break;
+				}
+				case 6:
+					*dst = Pixel(scale(sample(x * 4)), scale(sample(x * 4 + 1)), scale(sample(x * 4 + 2)), scale(sample(x * 4 + 3)));
+					break;
+				}
+			}
+		}
+
+		static bool png_decode(const uint8_t* data, size_t size, Pixel* pixels, int32_t stride)
+		{
+			PngInfo info;
+			if (!png_header(data, size, info) || !png_chunks(data, size, info))
+				return false;
+			if (info.color == 3 && info.palette_count == 0)
+				return false;
+
+			size_t bits_per_pixel = (size_t)info.channels * info.depth;
+			size_t bpp = std::max<size_t>(1, bits_per_pixel / 8);
+			auto row_bytes = [&](int32_t w) { return ((size_t)w * bits_per_pixel + 7) / 8; };
+
+			// adam7 passes: start x, start y, step x, step y
+			static const int32_t passes[7][4] = { { 0, 0, 8, 8 }, { 4, 0, 8, 8 }, { 0, 4, 4, 8 }, { 2, 0, 4, 4 }, { 0, 2, 2, 4 }, { 1, 0, 2, 2 }, { 0, 1, 1, 2 } };
+			static const int32_t single_pass[1][4] = { { 0, 0, 1, 1 } };
+			const int32_t(*layout)[4] = info.interlace ? passes : single_pass;
+			int32_t pass_count = info.interlace ? 7 : 1;
+
+			size_t total = 0;
+			for (int32_t p = 0; p < pass_count; p++)
+			{
+				int32_t pw = (info.width - layout[p][0] + layout[p][2] - 1) / layout[p][2];
+				int32_t ph = (info.height - layout[p][1] + layout[p][3] - 1) / layout[p][3];
+				if (pw > 0 && ph > 0)
+					total += (row_bytes(pw) + 1) * ph;
+			}
+
+			std::vector<uint8_t> raw;
+			if (!inflate_zlib(info.idat.data(), info.idat.size(), raw, total) || raw.size() != total)
+				return false;
+
+			// unfiltering is sequential, the conversion to pixels is not
+			uint8_t* rows = raw.data();
+			for (int32_t p = 0; p < pass_count; p++)
+			{
+				int32_t pw = (info.width - layout[p][0] + layout[p][2] - 1) / layout[p][2];
+				int32_t ph = (info.height - layout[p][1] + layout[p][3] - 1) / layout[p][3];
+				if (pw <= 0 || ph <= 0)
+					continue;
+
+				size_t rb = row_bytes(pw);
+				if (!png_unfilter(rows, ph, rb, bpp))
+					return false;
+
+				const int32_t* l = layout[p];
+				parallel_rows(pw, ph, [&](int32_t y_begin, int32_t y_end)
+				{
+					for (int32_t y = y_begin; y < y_end; y++)
+						png_convert_row(info, rows + y * (rb + 1) + 1, pw,
+							pixels + (size_t)(l[1] + y * l[3]) * stride + l[0], l[2]);
+				});
+
+				rows += (rb + 1) * ph;
+			}
+
+			return true;
+		}
+
+		// qoi
+
+		static bool qoi_decode(const uint8_t* data, size_t size, Pixel* pixels, int32_t stride)
+		{
+			if (size < 22 || memcmp(data, "qoif", 4) != 0)
+				return false;
+
+			int32_t width = (int32_t)read_be32(data + 4);
+			int32_t height = (int32_t)read_be32(data + 8);
+
+			// previously seen pixels start out as transparent black
+			Pixel index[64];
+			for (auto& e : index)
+				e.n = 0;
+			Pixel px(0, 0, 0, 255);
+
+			// the stream ends with an 8 byte marker that is never read as ops
+			const uint8_t* p = data + 14;
+			const uint8_t* end = data + size - 8;
+			int32_t run = 0;
+
+			for (int32_t y = 0; y < height; y++)
+			{
+				Pixel* dst = pixels + (size_t)y * stride;
+				for (int32_t x = 0; x < width; x++)
+				{
+					if (run > 0)
+						run--;
+					else if (p < end)
+					{
+						uint8_t b = *p++;
+						if (b == 0xFE)
+						{
+							if (end - p < 3) return false;
+							px.r = p[0]; px.g = p[1]; px.b = p[2];
+							p += 3;
+						}
+						else if (b == 0xFF)
+						{
+							if (end - p < 4) return false;
+							px.r = p[0]; px.g = p[1]; px.b = p[2]; px.a = p[3];
+							p += 4;
+						}
+						else if ((b & 0xC0) == 0x00)
+							px = index[b];
+						else if ((b & 0xC0) == 0x40)
+						{
+							px.r += ((b >> 4) & 3) - 2;
+							px.g += ((b >> 2) & 3) - 2;
+							px.b += (b & 3) - 2;
+						}
+						else if ((b & 0xC0) == 0x80)
+						{
+							if (p >= end) return false;
+							int32_t dg = (b & 0x3F) - 32;
+							uint8_t b2 = *p++;
+							px.r += dg - 8 + ((b2 >> 4) & 15);
+							px.g += dg;
+							px.b += dg - 8 + (b2 & 15);
+						}
+						else
+							run = b & 0x3F;
+
+						index[(px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11) % 64] = px;
+					}
+					else
+						return false;
+
+					dst[x] = px;
+				}
+			}
+
+			return true;
+		}
+
+
+		Format probe(const uint8_t* data, size_t size, int32_t& width, int32_t& height)
+		{
+			BmpInfo bmp;
+			if (bmp_info(data, size, bmp))
+			{
+				width = bmp.width;
+				height = bmp.height;
+				return BMP;
+			}
+
+			PngInfo png;
+			if (png_header(data, size, png))
+			{
+				width = png.width;
+				height = png.height;
+				return PNG;
+			}
+
+			if (size >= 22 && memcmp(data, "qoif", 4) == 0)
+			{
+				int64_t w = read_be32(data + 4), h = read_be32(data + 8);
+				if (valid_size(w, h))
+				{
+					width = (int32_t)w;
+					height = (int32_t)h;
+					return QOI;
+				}
+			}
+
+			return UNKNOWN;
+		}
+
+		bool decode(const uint8_t* data, size_t size, Pixel* pixels, int32_t stride)
+		{
+			int32_t width, height;
+			switch (probe(data, size, width, height))
+			{
+			case BMP: return bmp_decode(data, size, pixels, stride);
+			case PNG: return png_decode(data, size, pixels, stride);
+			case QOI: return qoi_decode(data, size, pixels, stride);
+			default: return false;
+			}
+		}
+	}
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "Melody.h"
+
+namespace Melody
+{
+	// built in decoders for bmp, png and qoi, no platform image library needed
+	namespace ImageDecoder
+	{
+		enum Format
+		{
+			UNKNOWN,
+			BMP,	// 1, 4, 8, 16, 24 and 32 bit, uncompressed or bitfields
+			PNG,	// every colour type and bit depth, interlaced or not
+			QOI
+		};
+
+		// identifies the format and reads the dimensions without decoding
+		Format probe(const uint8_t* data, size_t size, int32_t& width, int32_t& height);
+
+		// decodes into rows of width pixels that start stride pixels apart,
+		// large images are converted in parallel strips where the format allows
+		bool decode(const uint8_t* data, size_t size, Pixel* pixels, int32_t stride);
+	}
+}
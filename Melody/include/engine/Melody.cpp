@@ -1,8 +1,23 @@
 #include "Melody.h"
+#include "ImageDecoder.h"
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifdef _WIN32
 #include <GL/gl.h>
 typedef BOOL(WINAPI wglSwapInterval_t) (int interval);
 wglSwapInterval_t* wglSwapInterval;
+#endif
+
+#if !defined(MELODY_NO_SIMD) && defined(__AVX2__)
+#define MELODY_AVX2
+#include <immintrin.h>
+#elif !defined(MELODY_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define MELODY_SSE2
+#include <emmintrin.h>
+#endif
 
 namespace Melody
 {
@@ -22,6 +37,318 @@ namespace Melody
 		a = alpha;
 	}
 
+	// x / 255 rounded to nearest, exact for x <= 65535 - 255
+	static inline uint32_t div255(uint32_t x)
+	{
+		x += 128;
+		return (x + (x >> 8)) >> 8;
+	}
+
+	Pixel blend_pixel(Pixel d, Pixel s)
+	{
+		uint32_t a = s.a;
+		uint32_t c = 255 - a;
+		return Pixel(
+			(uint8_t)div255(s.r * a + d.r * c),
+			(uint8_t)div255(s.g * a + d.g * c),
+			(uint8_t)div255(s.b * a + d.b * c),
+			(uint8_t)div255(s.a * 255 + d.a * c));
+	}
+
+#if defined(MELODY_SSE2) || defined(MELODY_AVX2)
+	// 16 bit lanes hold r, g, b, a of each pixel; the alpha lane takes the source at full weight
+	static inline __m128i blend_weights_128(__m128i s16, __m128i& inv)
+	{
+		__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s16, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		inv = _mm_sub_epi16(_mm_set1_epi16(255), a);
+		__m128i rgb_mask = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+		__m128i alpha_full = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+		return _mm_or_si128(_mm_and_si128(a, rgb_mask), alpha_full);
+	}
+
+	static inline __m128i div255_128(__m128i x)
+	{
+		x = _mm_add_epi16(x, _mm_set1_epi16(128));
+		return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+	}
+
+	static inline __m128i blend_half_128(__m128i s16, __m128i d16)
+	{
+		__m128i inv;
+		__m128i w = blend_weights_128(s16, inv);
+		return div255_128(_mm_add_epi16(_mm_mullo_epi16(s16, w), _mm_mullo_epi16(d16, inv)));
+	}
+
+	static inline __m128i blend_4(__m128i s, __m128i d)
+	{
+		__m128i zero = _mm_setzero_si128();
+		__m128i lo = blend_half_128(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero));
+		__m128i hi = blend_half_128(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero));
+		return _mm_packus_epi16(lo, hi);
+	}
+#endif
+
+#if defined(MELODY_AVX2)
+	static inline __m256i div255_256(__m256i x)
+	{
+		x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+		return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+	}
+
+	static inline __m256i blend_half_256(__m256i s16, __m256i d16)
+	{
+		__m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s16, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		__m256i inv = _mm256_sub_epi16(_mm256_set1_epi16(255), a);
+		__m256i rgb_mask = _mm256_set_epi16(0, -1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1);
+		__m256i alpha_full = _mm256_set_epi16(255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0);
+		__m256i w = _mm256_or_si256(_mm256_and_si256(a, rgb_mask), alpha_full);
+		return div255_256(_mm256_add_epi16(_mm256_mullo_epi16(s16, w), _mm256_mullo_epi16(d16, inv)));
+	}
+
+	static inline __m256i blend_8(__m256i s, __m256i d)
+	{
+		// unpack and pack both work within 128 bit lanes, so pixel order is preserved
+		__m256i zero = _mm256_setzero_si256();
+		__m256i lo = blend_half_256(_mm256_unpacklo_epi8(s, zero), _mm256_unpacklo_epi8(d, zero));
+		__m256i hi = blend_half_256(_mm256_unpackhi_epi8(s, zero), _mm256_unpackhi_epi8(d, zero));
+		return _mm256_packus_epi16(lo, hi);
+	}
+#endif
+
+	void blend_row(Pixel* dst, const Pixel* src, int32_t count)
+	{
+		int32_t i = 0;
+
+#if defined(MELODY_AVX2)
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+			__m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+			_mm256_storeu_si256((__m256i*)(dst + i), blend_8(s, d));
+		}
+#endif
+
+#if defined(MELODY_SSE2) || defined(MELODY_AVX2)
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+			__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+			_mm_storeu_si128((__m128i*)(dst + i), blend_4(s, d));
+		}
+#endif
+
+		for (; i < count; i++)
+			dst[i] = blend_pixel(dst[i], src[i]);
+	}
+
+	void blend_fill(Pixel* dst, Pixel src, int32_t count)
+	{
+		// fully opaque or fully transparent sources need no arithmetic
+		if (src.a == 255)
+		{
+			std::fill_n(dst, count, src);
+			return;
+		}
+
+		if (src.a == 0)
+			return;
+
+		int32_t i = 0;
+
+#if defined(MELODY_AVX2)
+		__m256i s8 = _mm256_set1_epi32((int)src.n);
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+			_mm256_storeu_si256((__m256i*)(dst + i), blend_8(s8, d));
+		}
+#endif
+
+#if defined(MELODY_SSE2) || defined(MELODY_AVX2)
+		__m128i s4 = _mm_set1_epi32((int)src.n);
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+			_mm_storeu_si128((__m128i*)(dst + i), blend_4(s4, d));
+		}
+#endif
+
+		for (; i < count; i++)
+			dst[i] = blend_pixel(dst[i], src);
+	}
+
+	Pixel blend_premultiplied_pixel(Pixel d, Pixel s)
+	{
+		// the saturation only matters for colours brighter than their alpha, which premultiplied ones never are
+		uint32_t c = 255 - s.a;
+		return Pixel(
+			(uint8_t)std::min(s.r + div255(d.r * c), 255u),
+			(uint8_t)std::min(s.g + div255(d.g * c), 255u),
+			(uint8_t)std::min(s.b + div255(d.b * c), 255u),
+			(uint8_t)std::min(s.a + div255(d.a * c), 255u));
+	}
+
+#if defined(MELODY_SSE2) || defined(MELODY_AVX2)
+	// the source is added as it is, only the destination is unpacked and weighed
+	static inline __m128i blend_premultiplied_4(__m128i s, __m128i d)
+	{
+		__m128i zero = _mm_setzero_si128();
+		__m128i inv = _mm_srli_epi32(_mm_andnot_si128(s, _mm_set1_epi32((int)0xFF000000)), 24);
+		inv = _mm_or_si128(inv, _mm_slli_epi32(inv, 16));
+		__m128i lo = div255_128(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi32(inv, inv)));
+		__m128i hi = div255_128(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi32(inv, inv)));
+		return _mm_adds_epu8(s, _mm_packus_epi16(lo, hi));
+	}
+
+	// colour times alpha, alpha kept
+	static inline __m128i premultiply_4(__m128i p)
+	{
+		__m128i zero = _mm_setzero_si128();
+		__m128i inv;
+		__m128i lo = _mm_unpacklo_epi8(p, zero);
+		__m128i hi = _mm_unpackhi_epi8(p, zero);
+		lo = div255_128(_mm_mullo_epi16(lo, blend_weights_128(lo, inv)));
+		hi = div255_128(_mm_mullo_epi16(hi, blend_weights_128(hi, inv)));
+		return _mm_packus_epi16(lo, hi);
+	}
+#endif
+
+#if defined(MELODY_AVX2)
+	static inline __m256i blend_premultiplied_8(__m256i s, __m256i d)
+	{
+		// unpacks stay within 128 bit lanes on both sides, so the weights line up with their pixels
+		__m256i zero = _mm256_setzero_si256();
+		__m256i inv = _mm256_srli_epi32(_mm256_andnot_si256(s, _mm256_set1_epi32((int)0xFF000000)), 24);
+		inv = _mm256_or_si256(inv, _mm256_slli_epi32(inv, 16));
+		__m256i lo = div255_256(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi32(inv, inv)));
+		__m256i hi = div255_256(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi32(inv, inv)));
+		return _mm256_adds_epu8(s, _mm256_packus_epi16(lo, hi));
+	}
+#endif
+
+	void blend_premultiplied_row(Pixel* dst, const Pixel* src, int32_t count)
+	{
+		int32_t i = 0;
+
+#if defined(MELODY_AVX2)
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+			__m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+			_mm256_storeu_si256((__m256i*)(dst + i), blend_premultiplied_8(s, d));
+		}
+#endif
+
+#if defined(MELODY_SSE2) || defined(MELODY_AVX2)
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+			__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+			_mm_storeu_si128((__m128i*)(dst + i), blend_premultiplied_4(s, d));
+		}
+#endif
+
+		for (; i < count; i++)
+			dst[i] = blend_premultiplied_pixel(dst[i], src[i]);
+	}
+
+	static void premultiply_row(Pixel* row, int32_t count)
+	{
+		int32_t i = 0;
+
+#if defined(MELODY_SSE2) || defined(MELODY_AVX2)
+		for (; i + 4 <= count; i += 4)
+			_mm_storeu_si128((__m128i*)(row + i), premultiply_4(_mm_loadu_si128((const __m128i*)(row + i))));
+#endif
+
+		for (; i < count; i++)
+		{
+			uint32_t a = row[i].a;
+			row[i] = Pixel((uint8_t)div255(row[i].r * a), (uint8_t)div255(row[i].g * a), (uint8_t)div255(row[i].b * a), (uint8_t)a);
+		}
+	}
+
+	// sprite sampling for transformed draws, source coordinates are stepped in 16.16 fixed point
+	static const int32_t SAMPLE_SHIFT = 16;
+	static const int64_t SAMPLE_ONE = (int64_t)1 << SAMPLE_SHIFT;
+
+	// f is 0 - 256, every 8 bit channel times its weight still fits its 16 bit lane
+	static inline uint32_t lerp_pixel(uint32_t p, uint32_t q, uint32_t f)
+	{
+		uint32_t rb = ((p & 0x00FF00FF) * (256 - f) + (q & 0x00FF00FF) * f) >> 8;
+		uint32_t ga = ((p >> 8) & 0x00FF00FF) * (256 - f) + ((q >> 8) & 0x00FF00FF) * f;
+		return (rb & 0x00FF00FF) | (ga & 0xFF00FF00);
+	}
+
+	// count samples from (u, v) on, stepping by (du, dv), every one of them inside the sprite
+	static inline void sample_nearest_row(const Sprite* sprite, Pixel* out, int32_t count, int64_t u, int64_t v, int64_t du, int64_t dv)
+	{
+		const Pixel* src = sprite->get_data();
+		int64_t stride = sprite->get_stride();
+		for (int32_t i = 0; i < count; i++, u += du, v += dv)
+			out[i] = src[(v >> SAMPLE_SHIFT) * stride + (u >> SAMPLE_SHIFT)];
+	}
+
+	static inline void sample_bilinear_row(const Sprite* sprite, Pixel* out, int32_t count, int64_t u, int64_t v, int64_t du, int64_t dv)
+	{
+		const Pixel* src = sprite->get_data();
+		int32_t stride = sprite->get_stride();
+		int32_t last_x = sprite->_width - 1;
+		int32_t last_y = sprite->_height - 1;
+
+		// weigh the pixel centres around the point, edges repeat the outermost pixels
+		u -= SAMPLE_ONE / 2;
+		v -= SAMPLE_ONE / 2;
+		for (int32_t i = 0; i < count; i++, u += du, v += dv)
+		{
+			int32_t x0 = (int32_t)(u >> SAMPLE_SHIFT);
+			int32_t y0 = (int32_t)(v >> SAMPLE_SHIFT);
+			uint32_t fx = (uint32_t)(u >> (SAMPLE_SHIFT - 8)) & 255;
+			uint32_t fy = (uint32_t)(v >> (SAMPLE_SHIFT - 8)) & 255;
+
+			int32_t xa = std::max(x0, 0);
+			int32_t xb = std::min(x0 + 1, last_x);
+			const Pixel* ra = src + std::max(y0, 0) * stride;
+			const Pixel* rb = src + std::min(y0 + 1, last_y) * stride;
+
+			uint32_t top = lerp_pixel(ra[xa].n, ra[xb].n, fx);
+			uint32_t bottom = lerp_pixel(rb[xa].n, rb[xb].n, fx);
+			out[i].n = lerp_pixel(top, bottom, fy);
+		}
+	}
+
+	// rows start on this many bytes so simd loads and stores never split a cache line
+	static const size_t ROW_ALIGNMENT = 64;
+	static const int32_t ROW_ALIGNMENT_PIXELS = (int32_t)(ROW_ALIGNMENT / sizeof(Pixel));
+
+	static void* allocate_aligned(size_t bytes)
+	{
+		// the block malloc returned is kept just in front of the aligned pointer
+		uint8_t* block = (uint8_t*)malloc(bytes + ROW_ALIGNMENT + sizeof(void*));
+		if (!block)
+			throw std::bad_alloc();
+
+		uintptr_t aligned = ((uintptr_t)block + sizeof(void*) + ROW_ALIGNMENT - 1) & ~(uintptr_t)(ROW_ALIGNMENT - 1);
+		((void**)aligned)[-1] = block;
+		return (void*)aligned;
+	}
+
+	static void free_aligned(void* data)
+	{
+		if (data)
+			free(((void**)data)[-1]);
+	}
+
+	static Pixel* allocate_pixels(size_t count)
+	{
+		return (Pixel*)allocate_aligned(count * sizeof(Pixel));
+	}
+
+	static void free_pixels(Pixel* data)
+	{
+		free_aligned(data);
+	}
+
 	Sprite::Sprite()
 	{
 		_width = 0;
@@ -36,25 +363,119 @@ namespace Melody
 
 	Sprite::Sprite(int32_t w, int32_t h)
 	{
-		if (_color_data)
-			delete[] _color_data;
+		allocate(w, h, nullptr);
+	}
+
+	Sprite::Sprite(int32_t w, int32_t h, PixelPool* pool)
+	{
+		allocate(w, h, pool);
+	}
 
+	Sprite::Sprite(int32_t w, int32_t h, Pixel* data, int32_t stride)
+	{
 		_width = w;
 		_height = h;
-		_color_data = new Pixel[_width * _height];
-
-		for (int32_t i = 0; i > _width * _height; i++)
-			_color_data[i] = Pixel();
+		_stride = stride > 0 ? stride : w;
+		_color_data = data;
+		_owns_data = false;
 	}
 
 	Sprite::~Sprite()
 	{
-		if (_color_data)
-			delete[] _color_data;
+		release();
+	}
+
+	Sprite::Sprite(Sprite&& other) noexcept
+	{
+		*this = std::move(other);
+	}
+
+	Sprite& Sprite::operator=(Sprite&& other) noexcept
+	{
+		if (this == &other)
+			return *this;
+
+		other.settle();
+		release();
+		_width = other._width;
+		_height = other._height;
+		_stride = other._stride;
+		_color_data = other._color_data;
+		_pool = other._pool;
+		_owns_data = other._owns_data;
+		_premultiplied = other._premultiplied;
+
+		other._width = 0;
+		other._height = 0;
+		other._stride = 0;
+		other._color_data = nullptr;
+		other._pool = nullptr;
+		other._owns_data = true;
+		other._premultiplied = false;
+		return *this;
+	}
+
+	void Sprite::allocate(int32_t w, int32_t h, PixelPool* pool)
+	{
+		release();
+		if (w <= 0 || h <= 0)
+			return;
+
+		_width = w;
+		_height = h;
+		_stride = (w + ROW_ALIGNMENT_PIXELS - 1) / ROW_ALIGNMENT_PIXELS * ROW_ALIGNMENT_PIXELS;
+		_pool = pool;
+
+		size_t count = (size_t)_stride * _height;
+		_color_data = pool ? pool->allocate(count) : allocate_pixels(count);
+		std::uninitialized_fill_n(_color_data, count, Pixel());
+	}
+
+	void Sprite::release()
+	{
+		settle();
+		if (_color_data && _owns_data)
+		{
+			if (_pool)
+				_pool->release(_color_data, (size_t)_stride * _height);
+			else
+				free_pixels(_color_data);
+		}
+
+		_width = 0;
+		_height = 0;
+		_stride = 0;
+		_color_data = nullptr;
+		_pool = nullptr;
+		_owns_data = true;
+		_premultiplied = false;
 	}
 
 	ReturnCode Sprite::load_from_file(std::string image_file)
 	{
+		std::ifstream file(image_file, std::ios::binary | std::ios::ate);
+		if (!file.is_open())
+			return ReturnCode::NO_FILE;
+
+		std::vector<uint8_t> bytes((size_t)file.tellg());
+		file.seekg(0);
+		file.read((char*)bytes.data(), bytes.size());
+		file.close();
+
+		// bmp, png and qoi decode straight into the pixel buffer
+		int32_t w = 0, h = 0;
+		if (ImageDecoder::probe(bytes.data(), bytes.size(), w, h) != ImageDecoder::UNKNOWN)
+		{
+			Sprite decoded(w, h);
+			if (ImageDecoder::decode(bytes.data(), bytes.size(), decoded._color_data, decoded._stride))
+			{
+				*this = std::move(decoded);
+				return ReturnCode::OK;
+			}
+		}
+
+#ifdef _WIN32
+		// anything else goes through gdi+
 		std::wstring ws_image_file;
 
 		std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
@@ -62,527 +483,3187 @@ namespace Melody
 
 		Gdiplus::Bitmap* bmp = Gdiplus::Bitmap::FromFile(ws_image_file.c_str());
 
-		if (bmp == nullptr)
-			return ReturnCode::NO_FILE;
+		if (bmp == nullptr || bmp->GetLastStatus() != Gdiplus::Ok)
+		{
+			delete bmp;
+			return ReturnCode::FAIL;
+		}
+
+		// lock the whole bitmap once instead of a GetPixel call per pixel
+		Gdiplus::Rect rect(0, 0, bmp->GetWidth(), bmp->GetHeight());
+		Gdiplus::BitmapData locked;
+		if (bmp->LockBits(&rect, Gdiplus::ImageLockModeRead, PixelFormat32bppARGB, &locked) != Gdiplus::Ok)
+		{
+			delete bmp;
+			return ReturnCode::FAIL;
+		}
 
-		_width = bmp->GetWidth();
-		_height = bmp->GetHeight();
-		_color_data = new Pixel[_width * _height];
+		allocate(rect.Width, rect.Height, nullptr);
 
-		for (int x = 0; x < _width; x++)
+		for (int32_t y = 0; y < _height; y++)
 		{
-			for (int y = 0; y < _height; y++)
-			{
-				Gdiplus::Color c;
-				bmp->GetPixel(x, y, &c);
-				set_pixel(x, y, Pixel(c.GetRed(), c.GetGreen(), c.GetBlue(), c.GetAlpha()));
-			}
+			const uint8_t* src = (const uint8_t*)locked.Scan0 + (ptrdiff_t)y * locked.Stride;
+			Pixel* dst = _color_data + y * _stride;
+			for (int32_t x = 0; x < _width; x++, src += 4)
+				dst[x] = Pixel(src[2], src[1], src[0], src[3]);
 		}
+
+		bmp->UnlockBits(&locked);
 		delete bmp;
 		return ReturnCode::OK;
+#else
+		return ReturnCode::FAIL;
+#endif
 	}
 
 	Pixel Sprite::get_pixel(int32_t x, int32_t y) const
 	{
+		settle();
 		if (x >= 0 && x < _width && y >= 0 && y < _height)
-			return _color_data[y * _width + x];
+			return _color_data[y * _stride + x];
 		else
 			return Pixel();
 	}
 
 	void Sprite::set_pixel(int32_t x, int32_t y, Pixel p)
 	{
+		settle();
 		if (x >= 0 && x < _width && y >= 0 && y < _height)
-			_color_data[y * _width + x] = p;
+			_color_data[y * _stride + x] = p;
 	}
 
-	Pixel Sprite::sample(float x, float y) const
+	Pixel Sprite::sample(float x, float y, Filter filter) const
 	{
-		int32_t sx = (int32_t)(x * (float)_width);
-		int32_t sy = (int32_t)(y * (float)_height);
-		return get_pixel(sx, sy);
+		if (filter == NEAREST)
+		{
+			int32_t sx = (int32_t)(x * (float)_width);
+			int32_t sy = (int32_t)(y * (float)_height);
+			return get_pixel(sx, sy);
+		}
+
+		if (!(x >= 0.0f && x < 1.0f && y >= 0.0f && y < 1.0f))
+			return Pixel();
+
+		Pixel p;
+		sample_bilinear_row(this, &p, 1, (int64_t)((double)x * _width * SAMPLE_ONE), (int64_t)((double)y * _height * SAMPLE_ONE), 0, 0);
+		return p;
 	}
 
 	Pixel* Sprite::get_data() const
 	{
+		settle();
 		return _color_data;
 	}
 
-	Engine::Engine()
+	int32_t Sprite::get_stride() const
 	{
-		_app_name = "Melody";
+		return _stride;
 	}
 
-	ReturnCode Engine::construct(uint32_t screen_w, uint32_t screen_h, uint32_t pixel_w, uint32_t pixel_h)
+	void Sprite::premultiply()
 	{
-		_screen_width = screen_w;
-		_screen_height = screen_h;
-		_pixel_width = pixel_w;
-		_pixel_height = pixel_h;
+		if (_premultiplied || !_color_data)
+			return;
 
-		std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
-		_window_name = converter.from_bytes(_app_name);
+		settle();
+		for (int32_t y = 0; y < _height; y++)
+			premultiply_row(_color_data + y * _stride, _width);
+		_premultiplied = true;
+	}
 
-		_default_drawing_target = new Sprite(_screen_width, _screen_height);
-		set_drawing_target(nullptr);
-		return ReturnCode::OK;
+	void Sprite::unpremultiply()
+	{
+		if (!_premultiplied)
+			return;
+
+		settle();
+		for (int32_t y = 0; y < _height; y++)
+		{
+			Pixel* row = _color_data + y * _stride;
+			for (int32_t x = 0; x < _width; x++)
+			{
+				uint32_t a = row[x].a;
+				auto restore = [&](uint8_t c) { return a ? (uint8_t)std::min((c * 255u + a / 2) / a, 255u) : (uint8_t)0; };
+				row[x] = Pixel(restore(row[x].r), restore(row[x].g), restore(row[x].b), (uint8_t)a);
+			}
+		}
+		_premultiplied = false;
 	}
 
-	ReturnCode Engine::Start()
+	bool Sprite::is_premultiplied() const
 	{
-		if (!create_window())
-			return ReturnCode::FAIL;
+		return _premultiplied;
+	}
 
-		ULONG_PTR token;
-		Gdiplus::GdiplusStartupInput startup_input;
-		Gdiplus::GdiplusStartup(&token, &startup_input, NULL);
+	PlanarSprite::PlanarSprite()
+	{
+	}
 
-		_atom_active = true;
-		std::thread t = std::thread(&Engine::threading, this);
+	PlanarSprite::PlanarSprite(int32_t w, int32_t h)
+	{
+		allocate(w, h);
+	}
 
-		MSG msg;
-		while (GetMessage(&msg, NULL, 0, 0) > 0)
+	PlanarSprite::PlanarSprite(const Sprite& sprite)
+	{
+		load(sprite);
+	}
+
+	PlanarSprite::~PlanarSprite()
+	{
+		release();
+	}
+
+	PlanarSprite::PlanarSprite(PlanarSprite&& other) noexcept
+	{
+		*this = std::move(other);
+	}
+
+	PlanarSprite& PlanarSprite::operator=(PlanarSprite&& other) noexcept
+	{
+		if (this == &other)
+			return *this;
+
+		release();
+		_width = other._width;
+		_height = other._height;
+		_stride = other._stride;
+		_data = other._data;
+		_premultiplied = other._premultiplied;
+
+		other._width = 0;
+		other._height = 0;
+		other._stride = 0;
+		other._data = nullptr;
+		other._premultiplied = false;
+		return *this;
+	}
+
+	void PlanarSprite::allocate(int32_t w, int32_t h)
+	{
+		release();
+		if (w <= 0 || h <= 0)
+			return;
+
+		_width = w;
+		_height = h;
+		_stride = (int32_t)((w + ROW_ALIGNMENT - 1) / ROW_ALIGNMENT * ROW_ALIGNMENT);
+
+		// the four planes follow each other in one block, every one of them starts on a row boundary
+		size_t plane = (size_t)_stride * _height;
+		_data = (uint8_t*)allocate_aligned(plane * 4);
+		memset(_data, 0, plane * 3);
+		memset(_data + plane * 3, 255, plane);
+	}
+
+	void PlanarSprite::release()
+	{
+		free_aligned(_data);
+		_width = 0;
+		_height = 0;
+		_stride = 0;
+		_data = nullptr;
+		_premultiplied = false;
+	}
+
+	uint8_t* PlanarSprite::get_plane(Channel channel) const
+	{
+		return _data ? _data + (size_t)channel * _stride * _height : nullptr;
+	}
+
+	int32_t PlanarSprite::get_stride() const
+	{
+		return _stride;
+	}
+
+	void PlanarSprite::load(const Sprite& sprite)
+	{
+		if (_width != sprite._width || _height != sprite._height)
+			allocate(sprite._width, sprite._height);
+		if (!_data || !sprite.get_data())
+			return;
+
+		for (int32_t y = 0; y < _height; y++)
 		{
-			TranslateMessage(&msg);
-			DispatchMessage(&msg);
+			const Pixel* src = sprite.get_data() + y * sprite.get_stride();
+			uint8_t* r = get_plane(RED) + y * _stride;
+			uint8_t* g = get_plane(GREEN) + y * _stride;
+			uint8_t* b = get_plane(BLUE) + y * _stride;
+			uint8_t* a = get_plane(ALPHA) + y * _stride;
+			int32_t x = 0;
+
+#if defined(MELODY_SSE2) || defined(MELODY_AVX2)
+			// 16 pixels at a time, each channel is shifted down, masked and packed into its plane
+			__m128i mask = _mm_set1_epi32(0xFF);
+			for (; x + 16 <= _width; x += 16)
+			{
+				__m128i p[4];
+				for (int32_t k = 0; k < 4; k++)
+					p[k] = _mm_loadu_si128((const __m128i*)(src + x + 4 * k));
+
+				uint8_t* planes[4] = { r, g, b, a };
+				for (int32_t c = 0; c < 4; c++)
+				{
+					__m128i q[4];
+					for (int32_t k = 0; k < 4; k++)
+						q[k] = _mm_and_si128(_mm_srl_epi32(p[k], _mm_cvtsi32_si128(8 * c)), mask);
+					__m128i bytes = _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3]));
+					_mm_store_si128((__m128i*)(planes[c] + x), bytes);
+				}
+			}
+#endif
+
+			for (; x < _width; x++)
+			{
+				r[x] = src[x].r;
+				g[x] = src[x].g;
+				b[x] = src[x].b;
+				a[x] = src[x].a;
+			}
+		}
+
+		_premultiplied = sprite.is_premultiplied();
+	}
+
+	ReturnCode PlanarSprite::store(Sprite& sprite) const
+	{
+		if (!_data || !sprite.get_data() || sprite._width != _width || sprite._height != _height)
+			return ReturnCode::FAIL;
+
+		for (int32_t y = 0; y < _height; y++)
+		{
+			Pixel* dst = sprite.get_data() + y * sprite.get_stride();
+			const uint8_t* r = get_plane(RED) + y * _stride;
+			const uint8_t* g = get_plane(GREEN) + y * _stride;
+			const uint8_t* b = get_plane(BLUE) + y * _stride;
+			const uint8_t* a = get_plane(ALPHA) + y * _stride;
+			int32_t x = 0;
+
+#if defined(MELODY_SSE2) || defined(MELODY_AVX2)
+			// r g and b a byte pairs, then the pairs interleaved into whole pixels
+			for (; x + 16 <= _width; x += 16)
+			{
+				__m128i vr = _mm_load_si128((const __m128i*)(r + x));
+				__m128i vg = _mm_load_si128((const __m128i*)(g + x));
+				__m128i vb = _mm_load_si128((const __m128i*)(b + x));
+				__m128i va = _mm_load_si128((const __m128i*)(a + x));
+				__m128i rg_lo = _mm_unpacklo_epi8(vr, vg), rg_hi = _mm_unpackhi_epi8(vr, vg);
+				__m128i ba_lo = _mm_unpacklo_epi8(vb, va), ba_hi = _mm_unpackhi_epi8(vb, va);
+				_mm_storeu_si128((__m128i*)(dst + x), _mm_unpacklo_epi16(rg_lo, ba_lo));
+				_mm_storeu_si128((__m128i*)(dst + x + 4), _mm_unpackhi_epi16(rg_lo, ba_lo));
+				_mm_storeu_si128((__m128i*)(dst + x + 8), _mm_unpacklo_epi16(rg_hi, ba_hi));
+				_mm_storeu_si128((__m128i*)(dst + x + 12), _mm_unpackhi_epi16(rg_hi, ba_hi));
+			}
+#endif
+
+			for (; x < _width; x++)
+				dst[x] = Pixel(r[x], g[x], b[x], a[x]);
+		}
+
+		sprite._premultiplied = _premultiplied;
+		return ReturnCode::OK;
+	}
+
+	void PlanarSprite::premultiply()
+	{
+		if (_premultiplied || !_data)
+			return;
+
+		for (int32_t y = 0; y < _height; y++)
+		{
+			const uint8_t* a = get_plane(ALPHA) + y * _stride;
+			for (int32_t c = RED; c <= BLUE; c++)
+			{
+				uint8_t* p = get_plane((Channel)c) + y * _stride;
+				int32_t x = 0;
+
+#if defined(MELODY_SSE2) || defined(MELODY_AVX2)
+				__m128i zero = _mm_setzero_si128();
+				for (; x + 16 <= _width; x += 16)
+				{
+					__m128i vp = _mm_load_si128((const __m128i*)(p + x));
+					__m128i va = _mm_load_si128((const __m128i*)(a + x));
+					__m128i lo = div255_128(_mm_mullo_epi16(_mm_unpacklo_epi8(vp, zero), _mm_unpacklo_epi8(va, zero)));
+					__m128i hi = div255_128(_mm_mullo_epi16(_mm_unpackhi_epi8(vp, zero), _mm_unpackhi_epi8(va, zero)));
+					_mm_store_si128((__m128i*)(p + x), _mm_packus_epi16(lo, hi));
+				}
+#endif
+
+				for (; x < _width; x++)
+					p[x] = (uint8_t)div255(p[x] * a[x]);
+			}
+		}
+		_premultiplied = true;
+	}
+
+	bool PlanarSprite::is_premultiplied() const
+	{
+		return _premultiplied;
+	}
+
+	Transform Transform::translate(float x, float y)
+	{
+		Transform t;
+		t.tx = x;
+		t.ty = y;
+		return t;
+	}
+
+	Transform Transform::rotate(float radians)
+	{
+		Transform t;
+		t.a = std::cos(radians);
+		t.b = std::sin(radians);
+		t.c = -t.b;
+		t.d = t.a;
+		return t;
+	}
+
+	Transform Transform::scale(float sx, float sy)
+	{
+		Transform t;
+		t.a = sx;
+		t.d = sy;
+		return t;
+	}
+
+	Transform Transform::shear(float sx, float sy)
+	{
+		Transform t;
+		t.c = sx;
+		t.b = sy;
+		return t;
+	}
+
+	Transform Transform::operator*(const Transform& other) const
+	{
+		Transform t;
+		t.a = a * other.a + c * other.b;
+		t.b = b * other.a + d * other.b;
+		t.c = a * other.c + c * other.d;
+		t.d = b * other.c + d * other.d;
+		t.tx = a * other.tx + c * other.ty + tx;
+		t.ty = b * other.tx + d * other.ty + ty;
+		return t;
+	}
+
+	Transform Transform::inverse() const
+	{
+		Transform t;
+		float det = a * d - b * c;
+		if (det == 0.0f || !std::isfinite(det))
+			return t;
+
+		t.a = d / det;
+		t.b = -b / det;
+		t.c = -c / det;
+		t.d = a / det;
+		t.tx = -(t.a * tx + t.c * ty);
+		t.ty = -(t.b * tx + t.d * ty);
+		return t;
+	}
+
+	void Transform::apply(float x, float y, float& out_x, float& out_y) const
+	{
+		out_x = a * x + c * y + tx;
+		out_y = b * x + d * y + ty;
+	}
+
+	PixelPool::PixelPool()
+	{
+	}
+
+	PixelPool::~PixelPool()
+	{
+		trim();
+	}
+
+	Pixel* PixelPool::allocate(size_t count)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			auto it = _free.find(count);
+			if (it != _free.end() && !it->second.empty())
+			{
+				Pixel* data = it->second.back();
+				it->second.pop_back();
+				_cached_bytes -= count * sizeof(Pixel);
+				return data;
+			}
+		}
+
+		return allocate_pixels(count);
+	}
+
+	void PixelPool::release(Pixel* data, size_t count)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_free[count].push_back(data);
+		_cached_bytes += count * sizeof(Pixel);
+	}
+
+	void PixelPool::trim()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (auto& bucket : _free)
+			for (Pixel* data : bucket.second)
+				free_pixels(data);
+		_free.clear();
+		_cached_bytes = 0;
+	}
+
+	size_t PixelPool::get_cached_bytes() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _cached_bytes;
+	}
+
+	// clip rectangle in target pixels, [x1, x2) x [y1, y2)
+	struct ClipRect
+	{
+		int32_t x1, y1, x2, y2;
+	};
+
+	static inline ClipRect full_clip(const Sprite* target)
+	{
+		return { 0, 0, target->_width, target->_height };
+	}
+
+	// a pixel mode as a type. writers take one in place of a Pixel::Mode, so every mode gets its own copy
+	// of their loops with the mode tests folded away, and with_mode picks the copy once per draw call
+	template<Pixel::Mode MODE>
+	using ModeTag = std::integral_constant<Pixel::Mode, MODE>;
+
+	template<typename F>
+	static inline void with_mode(Pixel::Mode mode, F f)
+	{
+		switch (mode)
+		{
+		case Pixel::Mode::NORMAL:	f(ModeTag<Pixel::Mode::NORMAL>());	break;
+		case Pixel::Mode::MASK:		f(ModeTag<Pixel::Mode::MASK>());	break;
+		case Pixel::Mode::ALPHA:	f(ModeTag<Pixel::Mode::ALPHA>());	break;
+		}
+	}
+
+	// p written over d
+	template<Pixel::Mode MODE>
+	static inline void mode_write(Pixel& d, Pixel p)
+	{
+		if (MODE == Pixel::Mode::NORMAL)
+			d = p;
+		else if (MODE == Pixel::Mode::MASK)
+			d = p.a == 255 ? p : d;
+		else
+			d = blend_pixel(d, p);
+	}
+
+	// raster writers, shared by immediate drawing and the tile workers
+	template<Pixel::Mode MODE>
+	static inline void pixel_write(Sprite* target, ModeTag<MODE>, const ClipRect& clip, int32_t x, int32_t y, Pixel p)
+	{
+		if (x < clip.x1 || x >= clip.x2 || y < clip.y1 || y >= clip.y2)
+			return;
+
+		mode_write<MODE>(target->get_data()[y * target->get_stride() + x], p);
+	}
+
+	template<Pixel::Mode MODE>
+	static void span_write(Sprite* target, ModeTag<MODE>, const ClipRect& clip, int32_t x1, int32_t x2, int32_t y, Pixel p)
+	{
+		if (y < clip.y1 || y >= clip.y2)
+			return;
+
+		if (x1 > x2) std::swap(x1, x2);
+		if (x1 < clip.x1) x1 = clip.x1;
+		if (x2 >= clip.x2) x2 = clip.x2 - 1;
+		if (x1 > x2)
+			return;
+
+		Pixel* row = target->get_data() + y * target->get_stride() + x1;
+		int32_t count = x2 - x1 + 1;
+
+		// the colour is constant along the span, so the mask test is too
+		if (MODE == Pixel::Mode::NORMAL || (MODE == Pixel::Mode::MASK && p.a == 255))
+			std::fill_n(row, count, p);
+		else if (MODE == Pixel::Mode::ALPHA)
+			blend_fill(row, p, count);
+	}
+
+	template<Pixel::Mode MODE>
+	static void rect_write(Sprite* target, ModeTag<MODE> mode, const ClipRect& clip, int32_t x, int32_t y, int32_t w, int32_t h, Pixel p)
+	{
+		int32_t x2 = std::min(x + w, clip.x2);
+		int32_t y2 = std::min(y + h, clip.y2);
+		x = std::max(x, clip.x1);
+		y = std::max(y, clip.y1);
+
+		for (int32_t j = y; j < y2; j++)
+			if (x < x2)
+				span_write(target, mode, clip, x, x2 - 1, j, p);
+	}
+
+	// count pixels written over dst by pixel mode, premultiplied sources blend without weighing their colour
+	template<Pixel::Mode MODE>
+	static inline void row_write(Pixel* dst, const Pixel* src, int32_t count, ModeTag<MODE>, bool premultiplied = false)
+	{
+		if (MODE == Pixel::Mode::NORMAL)
+		{
+			// memmove, a sprite may be drawn onto itself
+			memmove(dst, src, count * sizeof(Pixel));
+		}
+		else if (MODE == Pixel::Mode::MASK)
+		{
+			for (int32_t i = 0; i < count; i++)
+				mode_write<MODE>(dst[i], src[i]);
+		}
+		else if (premultiplied)
+		{
+			blend_premultiplied_row(dst, src, count);
+		}
+		else
+		{
+			blend_row(dst, src, count);
+		}
+	}
+
+	template<Pixel::Mode MODE>
+	static void blit_write(Sprite* target, ModeTag<MODE> mode, const ClipRect& clip, int32_t x, int32_t y, const Sprite* sprite, int32_t ox, int32_t oy, int32_t w, int32_t h)
+	{
+		// clip the source rectangle to the sprite
+		if (ox < 0) { w += ox; x -= ox; ox = 0; }
+		if (oy < 0) { h += oy; y -= oy; oy = 0; }
+		if (ox + w > sprite->_width) w = sprite->_width - ox;
+		if (oy + h > sprite->_height) h = sprite->_height - oy;
+
+		// clip the destination rectangle
+		if (x < clip.x1) { w -= clip.x1 - x; ox += clip.x1 - x; x = clip.x1; }
+		if (y < clip.y1) { h -= clip.y1 - y; oy += clip.y1 - y; y = clip.y1; }
+		if (x + w > clip.x2) w = clip.x2 - x;
+		if (y + h > clip.y2) h = clip.y2 - y;
+
+		if (w <= 0 || h <= 0)
+			return;
+
+		int32_t src_stride = sprite->get_stride();
+		int32_t dst_stride = target->get_stride();
+		const Pixel* src = sprite->get_data() + oy * src_stride + ox;
+		Pixel* dst = target->get_data() + y * dst_stride + x;
+
+		bool premultiplied = sprite->is_premultiplied();
+		for (int32_t j = 0; j < h; j++)
+		{
+			row_write(dst, src, w, mode, premultiplied);
+			src += src_stride;
+			dst += dst_stride;
+		}
+	}
+
+	// the pixels the Bresenham walk from (x1, y1) to (x2, y2) visits, cut to the clip rectangle before walking.
+	// skip_start and skip_end leave out the end pixels, so joined segments touch each shared point once
+	template<Pixel::Mode MODE>
+	static void line_write(Sprite* target, ModeTag<MODE> mode, const ClipRect& clip, int32_t x1, int32_t y1, int32_t x2, int32_t y2, Pixel p, bool skip_start = false, bool skip_end = false)
+	{
+		// the mode comes down to a store, a blend or nothing for the whole line, opaque colours are stored in any of them
+		if (MODE != Pixel::Mode::NORMAL && p.a == 255)
+			return line_write(target, ModeTag<Pixel::Mode::NORMAL>(), clip, x1, y1, x2, y2, p, skip_start, skip_end);
+		if (MODE == Pixel::Mode::MASK || (MODE == Pixel::Mode::ALPHA && p.a == 0))
+			return;
+
+		int64_t dx = (int64_t)x2 - x1;
+		int64_t dy = (int64_t)y2 - y1;
+		int32_t stride = target->get_stride();
+
+		// horizontal and vertical lines are runs
+		if (dy == 0 || dx == 0)
+		{
+			bool horizontal = dy == 0;
+			int64_t a = horizontal ? x1 : y1;
+			int64_t b = horizontal ? x2 : y2;
+			int64_t step = a <= b ? 1 : -1;
+			if (skip_start) a += step;
+			if (skip_end) b -= step;
+			if ((b - a) * step < 0)
+				return;
+			if (a > b) std::swap(a, b);
+
+			if (horizontal)
+			{
+				a = std::max<int64_t>(a, clip.x1);
+				b = std::min<int64_t>(b, clip.x2 - 1);
+				if (a <= b)
+					span_write(target, mode, clip, (int32_t)a, (int32_t)b, y1, p);
+				return;
+			}
+
+			a = std::max<int64_t>(a, clip.y1);
+			b = std::min<int64_t>(b, clip.y2 - 1);
+			if (x1 < clip.x1 || x1 >= clip.x2 || a > b)
+				return;
+
+			Pixel* d = target->get_data() + a * stride + x1;
+			for (int64_t y = a; y <= b; y++, d += stride)
+				mode_write<MODE>(*d, p);
+			return;
+		}
+
+		// the walk runs along the major axis from its smaller end, after i major steps it has taken
+		// k(i) = (2 m i + M - tie) / 2M minor ones, x major lines step on ties and y major ones don't
+		bool x_major = std::abs(dy) <= std::abs(dx);
+		int64_t M = x_major ? std::abs(dx) : std::abs(dy);
+		int64_t m = x_major ? std::abs(dy) : std::abs(dx);
+		int64_t tie = x_major ? 0 : 1;
+		bool from_first = x_major ? dx > 0 : dy > 0;
+		int64_t xs = from_first ? x1 : x2;
+		int64_t ys = from_first ? y1 : y2;
+		int32_t s = (dx > 0) == (dy > 0) ? 1 : -1;
+		// 2 m i needs up to 66 bits, so it is split at bit 16 and the high part divided first
+		int64_t rest;
+		auto minor_at = [&](int64_t i)
+		{
+			int64_t high = ((2 * m) >> 16) * i;
+			int64_t low = ((high % (2 * M)) << 16) + ((2 * m) & 0xffff) * i + M - tie;
+			rest = low % (2 * M);
+			return ((high / (2 * M)) << 16) + low / (2 * M);
+		};
+
+		int64_t lo = (skip_start && from_first) || (skip_end && !from_first) ? 1 : 0;
+		int64_t hi = (skip_end && from_first) || (skip_start && !from_first) ? M - 1 : M;
+
+		// steps inside the clip along the major axis
+		int64_t major_start = x_major ? xs : ys;
+		lo = std::max(lo, (int64_t)(x_major ? clip.x1 : clip.y1) - major_start);
+		hi = std::min(hi, (int64_t)(x_major ? clip.x2 : clip.y2) - 1 - major_start);
+
+		// and along the minor one, k(i) never falls so they are one interval too
+		int64_t minor_start = x_major ? ys : xs;
+		int64_t minor_lo = x_major ? clip.y1 : clip.x1;
+		int64_t minor_hi = (x_major ? clip.y2 : clip.x2) - 1;
+		int64_t k_lo = s > 0 ? minor_lo - minor_start : minor_start - minor_hi;
+		int64_t k_hi = s > 0 ? minor_hi - minor_start : minor_start - minor_lo;
+
+		int64_t a = lo, b = hi + 1;
+		while (a < b)
+		{
+			int64_t mid = a + (b - a) / 2;
+			if (minor_at(mid) >= k_lo) b = mid; else a = mid + 1;
+		}
+		lo = a;
+
+		b = hi + 1;
+		while (a < b)
+		{
+			int64_t mid = a + (b - a) / 2;
+			if (minor_at(mid) > k_hi) b = mid; else a = mid + 1;
+		}
+		hi = a - 1;
+
+		if (lo > hi)
+			return;
+
+		// pick the walk up at the first visible step with the error term it would have there,
+		// 2 m - M + 2 m lo - 2 M k written with the remainder so it stays small
+		int64_t k = minor_at(lo);
+		int64_t e = rest + 2 * m - 2 * M + tie;
+		int64_t x = x_major ? xs + lo : xs + s * k;
+		int64_t y = x_major ? ys + s * k : ys + lo;
+		ptrdiff_t major_step = x_major ? 1 : stride;
+		ptrdiff_t minor_step = x_major ? (ptrdiff_t)s * stride : s;
+
+		Pixel* d = target->get_data() + y * stride + x;
+		for (int64_t i = lo; ; i++)
+		{
+			mode_write<MODE>(*d, p);
+			if (i == hi)
+				break;
+
+			d += major_step;
+			if (e >= tie)
+			{
+				d += minor_step;
+				e += 2 * (m - M);
+			}
+			else
+				e += 2 * m;
+		}
+	}
+
+	// inclusive target pixels an anti-aliased line can touch
+	static void line_aa_bounds(float x1, float y1, float x2, float y2, int32_t& bx1, int32_t& by1, int32_t& bx2, int32_t& by2)
+	{
+		const float limit = 1 << 28;
+		auto clamp = [&](float v) { return std::min(std::max(v, -limit), limit); };
+		bx1 = (int32_t)std::floor(clamp(std::min(x1, x2))) - 1;
+		by1 = (int32_t)std::floor(clamp(std::min(y1, y2))) - 1;
+		bx2 = (int32_t)std::ceil(clamp(std::max(x1, x2))) + 1;
+		by2 = (int32_t)std::ceil(clamp(std::max(y1, y2))) + 1;
+	}
+
+	// Xiaolin Wu's line, integer coordinates are pixel centres. every pixel is blended with p.a scaled by
+	// how much of it the line covers, its minor position is worked out fresh so clipped walks agree exactly
+	static void line_aa_write(Sprite* target, const ClipRect& clip, float x1, float y1, float x2, float y2, Pixel p)
+	{
+		if (!std::isfinite(x1) || !std::isfinite(y1) || !std::isfinite(x2) || !std::isfinite(y2) || p.a == 0)
+			return;
+
+		bool steep = std::fabs(y2 - y1) > std::fabs(x2 - x1);
+		if (steep)
+		{
+			std::swap(x1, y1);
+			std::swap(x2, y2);
+		}
+		if (x1 > x2)
+		{
+			std::swap(x1, x2);
+			std::swap(y1, y2);
+		}
+
+		// a and b are the major and minor axis from here on
+		int32_t a_lo = steep ? clip.y1 : clip.x1;
+		int32_t a_hi = (steep ? clip.y2 : clip.x2) - 1;
+		int32_t b_lo = steep ? clip.x1 : clip.y1;
+		int32_t b_hi = (steep ? clip.x2 : clip.y2) - 1;
+
+		auto plot = [&](int64_t a, int64_t b, float coverage)
+		{
+			if (a < a_lo || a > a_hi || b < b_lo || b > b_hi)
+				return;
+
+			uint8_t alpha = (uint8_t)(p.a * coverage + 0.5f);
+			if (alpha == 0)
+				return;
+
+			Pixel& d = steep ? target->get_data()[a * target->get_stride() + b] : target->get_data()[b * target->get_stride() + a];
+			d = blend_pixel(d, Pixel(p.r, p.g, p.b, alpha));
+		};
+
+		const float limit = 1 << 28;
+		if (std::fabs(x1) > limit || std::fabs(x2) > limit || std::fabs(y1) > limit || std::fabs(y2) > limit)
+			return;
+
+		float dx = x2 - x1;
+		float gradient = dx == 0.0f ? 1.0f : (y2 - y1) / dx;
+		auto fpart = [](float v) { return v - std::floor(v); };
+
+		// the end pixels are weighted by how far the line reaches into them
+		float a_end = std::round(x1);
+		float b_end = y1 + gradient * (a_end - x1);
+		float gap = 1.0f - fpart(x1 + 0.5f);
+		int64_t a_first = (int64_t)a_end;
+		plot(a_first, (int64_t)std::floor(b_end), (1.0f - fpart(b_end)) * gap);
+		plot(a_first, (int64_t)std::floor(b_end) + 1, fpart(b_end) * gap);
+
+		a_end = std::round(x2);
+		b_end = y2 + gradient * (a_end - x2);
+		gap = fpart(x2 + 0.5f);
+		int64_t a_last = (int64_t)a_end;
+		plot(a_last, (int64_t)std::floor(b_end), (1.0f - fpart(b_end)) * gap);
+		plot(a_last, (int64_t)std::floor(b_end) + 1, fpart(b_end) * gap);
+
+		// the run between them, trimmed to where the line is near the clip on both axes
+		int64_t first = std::max<int64_t>(a_first + 1, a_lo);
+		int64_t last = std::min<int64_t>(a_last - 1, a_hi);
+		if (gradient != 0.0f)
+		{
+			float e1 = x1 + (b_lo - 1 - y1) / gradient;
+			float e2 = x1 + (b_hi + 1 - y1) / gradient;
+			if (e1 > e2) std::swap(e1, e2);
+			first = std::max<int64_t>(first, (int64_t)std::floor(std::max(e1, -limit)) - 1);
+			last = std::min<int64_t>(last, (int64_t)std::ceil(std::min(e2, limit)) + 1);
+		}
+		else if (std::floor(y1) + 1 < b_lo || std::floor(y1) > b_hi)
+			return;
+
+		for (int64_t a = first; a <= last; a++)
+		{
+			float b = y1 + gradient * ((float)a - x1);
+			int64_t base = (int64_t)std::floor(b);
+			float f = b - (float)base;
+			plot(a, base, 1.0f - f);
+			plot(a, base + 1, f);
+		}
+	}
+
+	// columns [i, i + count) of a source row stretched to w pixels, column i shows source column (2i + 1) * sw / 2w.
+	// dir -1 reads the row backwards from its last pixel
+	static void expand_row(const Pixel* src, int32_t dir, int32_t sw, int32_t w, int32_t i, int32_t count, Pixel* out)
+	{
+		// whole multiples repeat every source pixel scale times
+		if (w % sw == 0)
+		{
+			int32_t scale = w / sw;
+			int32_t sx = i / scale;
+			int32_t n = scale - i % scale;
+			while (count > 0)
+			{
+				n = std::min(n, count);
+				std::fill_n(out, n, src[dir * sx]);
+				out += n;
+				count -= n;
+				sx++;
+				n = scale;
+			}
+			return;
+		}
+
+		// otherwise step the exact quotient and remainder along
+		int64_t den = 2 * (int64_t)w;
+		int64_t num = (2 * (int64_t)i + 1) * sw;
+		int32_t sx = (int32_t)(num / den);
+		int64_t rem = num % den;
+		int32_t q = sw / w;
+		int64_t r = 2 * (int64_t)(sw % w);
+		for (int32_t k = 0; k < count; k++)
+		{
+			out[k] = src[dir * sx];
+			sx += q;
+			rem += r;
+			if (rem >= den)
+			{
+				rem -= den;
+				sx++;
+			}
+		}
+	}
+
+	template<Pixel::Mode MODE>
+	static void resize_write(Sprite* target, ModeTag<MODE> mode, const ClipRect& clip, int32_t x, int32_t y, int32_t w, int32_t h, const Sprite* sprite, Sprite::Flip flip)
+	{
+		int32_t sw = sprite->_width;
+		int32_t sh = sprite->_height;
+		if (w <= 0 || h <= 0 || sw <= 0 || sh <= 0 || !sprite->get_data())
+			return;
+
+		// clipped destination in columns and rows from (x, y)
+		int32_t i1 = (int32_t)std::max<int64_t>((int64_t)clip.x1 - x, 0);
+		int32_t i2 = (int32_t)std::min<int64_t>((int64_t)clip.x2 - x, w);
+		int32_t j1 = (int32_t)std::max<int64_t>((int64_t)clip.y1 - y, 0);
+		int32_t j2 = (int32_t)std::min<int64_t>((int64_t)clip.y2 - y, h);
+		if (i1 >= i2 || j1 >= j2)
+			return;
+
+		bool flip_x = (flip & Sprite::FLIP_HORIZONTAL) != 0;
+		bool flip_y = (flip & Sprite::FLIP_VERTICAL) != 0;
+		int32_t dir = flip_x ? -1 : 1;
+		const Pixel* src_data = sprite->get_data();
+		int32_t src_stride = sprite->get_stride();
+		int32_t dst_stride = target->get_stride();
+
+		// a sprite drawn onto itself would read rows and columns it has already written, so it reads a copy
+		std::vector<Pixel> copy;
+		if (sprite == target)
+		{
+			copy.resize((size_t)sw * sh);
+			for (int32_t j = 0; j < sh; j++)
+				std::copy_n(src_data + (size_t)j * src_stride, sw, copy.data() + (size_t)j * sw);
+			src_data = copy.data();
+			src_stride = sw;
+		}
+
+		auto source_row = [&](int32_t j) { return (int32_t)(((2 * (int64_t)j + 1) * sh) / (2 * (int64_t)h)); };
+
+		const int32_t CHUNK = 256;
+		Pixel buffer[CHUNK];
+
+		for (int32_t j = j1; j < j2;)
+		{
+			// every row showing the same source row gets the one expansion
+			int32_t sy = source_row(j);
+			int32_t run = j + 1;
+			while (run < j2 && source_row(run) == sy)
+				run++;
+
+			const Pixel* src = src_data + (flip_y ? sh - 1 - sy : sy) * src_stride + (flip_x ? sw - 1 : 0);
+			Pixel* first = target->get_data() + (y + j) * dst_stride + x;
+
+			for (int32_t i = i1; i < i2; i += CHUNK)
+			{
+				int32_t count = std::min(i2 - i, CHUNK);
+
+				// opaque draws expand into the first row and copy it down, the others blend the expansion into each row
+				Pixel* out = MODE == Pixel::Mode::NORMAL ? first + i : buffer;
+				expand_row(src, dir, sw, w, i, count, out);
+
+				for (int32_t k = j; k < run; k++)
+				{
+					Pixel* dst = first + (k - j) * dst_stride + i;
+					if (dst != out)
+						row_write(dst, out, count, mode, sprite->is_premultiplied());
+				}
+			}
+
+			j = run;
+		}
+	}
+
+	// inclusive target pixels the transformed sprite can touch, false if it covers no area
+	static bool transformed_bounds(const Sprite* sprite, const Transform& t, int32_t& x1, int32_t& y1, int32_t& x2, int32_t& y2)
+	{
+		float det = t.a * t.d - t.b * t.c;
+		if (!sprite->get_data() || sprite->_width <= 0 || sprite->_height <= 0 || det == 0.0f || !std::isfinite(det))
+			return false;
+
+		float px[4], py[4];
+		t.apply(0.0f, 0.0f, px[0], py[0]);
+		t.apply((float)sprite->_width, 0.0f, px[1], py[1]);
+		t.apply(0.0f, (float)sprite->_height, px[2], py[2]);
+		t.apply((float)sprite->_width, (float)sprite->_height, px[3], py[3]);
+
+		// kept well inside int32 so the clipping arithmetic can't overflow
+		const float limit = 1 << 28;
+		auto clamp = [&](float v) { return std::min(std::max(v, -limit), limit); };
+		x1 = (int32_t)std::floor(clamp(std::min({ px[0], px[1], px[2], px[3] })));
+		y1 = (int32_t)std::floor(clamp(std::min({ py[0], py[1], py[2], py[3] })));
+		x2 = (int32_t)std::ceil(clamp(std::max({ px[0], px[1], px[2], px[3] }))) - 1;
+		y2 = (int32_t)std::ceil(clamp(std::max({ py[0], py[1], py[2], py[3] }))) - 1;
+		return x1 <= x2 && y1 <= y2;
+	}
+
+	// narrow [x1, x2) to the columns where start + x * step stays inside [0, limit)
+	static void sample_range(int64_t start, int64_t step, int64_t limit, int32_t& x1, int32_t& x2)
+	{
+		auto inside = [&](int32_t x) { int64_t u = start + x * step; return u >= 0 && u < limit; };
+
+		if (step == 0)
+		{
+			if (!inside(x1))
+				x2 = x1;
+			return;
+		}
+
+		// estimate the ends with some slack, then settle them on the exact fixed point values
+		double e1 = (double)-start / (double)step;
+		double e2 = (double)(limit - start) / (double)step;
+		if (e1 > e2) std::swap(e1, e2);
+		int32_t lo = (int32_t)std::min(std::max(std::floor(e1) - 2.0, (double)x1), (double)x2);
+		int32_t hi = (int32_t)std::min(std::max(std::ceil(e2) + 2.0, (double)lo), (double)x2);
+
+		while (lo < hi && !inside(lo)) lo++;
+		while (hi > lo && !inside(hi - 1)) hi--;
+		x1 = lo;
+		x2 = hi;
+	}
+
+	template<Pixel::Mode MODE>
+	static void transform_write(Sprite* target, ModeTag<MODE> mode, const ClipRect& clip, const Sprite* sprite, const Transform& transform, Sprite::Filter filter)
+	{
+		int32_t bx1, by1, bx2, by2;
+		if (!transformed_bounds(sprite, transform, bx1, by1, bx2, by2))
+			return;
+
+		bx1 = std::max(bx1, clip.x1);
+		by1 = std::max(by1, clip.y1);
+		bx2 = std::min(bx2 + 1, clip.x2);
+		by2 = std::min(by2 + 1, clip.y2);
+		if (bx1 >= bx2 || by1 >= by2)
+			return;
+
+		// sprite position of the centre of target pixel (x, y) is u00 + x * du_x + y * du_y,
+		// exact integers from here on so every tile steps through the same values
+		Transform inv = transform.inverse();
+		auto fixed = [](double v) { return (int64_t)std::llround(v * SAMPLE_ONE); };
+		int64_t u00 = fixed(0.5 * inv.a + 0.5 * inv.c + inv.tx), du_x = fixed(inv.a), du_y = fixed(inv.c);
+		int64_t v00 = fixed(0.5 * inv.b + 0.5 * inv.d + inv.ty), dv_x = fixed(inv.b), dv_y = fixed(inv.d);
+
+		// a sprite squeezed below 1/64k of a pixel per step or moved absurdly far is not worth the overflow risk
+		const int64_t limit = (int64_t)1 << 46;
+		if (std::abs(u00) > limit || std::abs(v00) > limit || std::abs(du_x) > (1 << 30) || std::abs(du_y) > (1 << 30)
+			|| std::abs(dv_x) > (1 << 30) || std::abs(dv_y) > (1 << 30))
+			return;
+
+		int64_t u_limit = (int64_t)sprite->_width << SAMPLE_SHIFT;
+		int64_t v_limit = (int64_t)sprite->_height << SAMPLE_SHIFT;
+
+		const int32_t CHUNK = 256;
+		Pixel buffer[CHUNK];
+
+		for (int32_t y = by1; y < by2; y++)
+		{
+			int64_t u_row = u00 + y * du_y;
+			int64_t v_row = v00 + y * dv_y;
+
+			// only the columns that sample inside the sprite
+			int32_t x1 = bx1, x2 = bx2;
+			sample_range(u_row, du_x, u_limit, x1, x2);
+			sample_range(v_row, dv_x, v_limit, x1, x2);
+
+			Pixel* dst = target->get_data() + y * target->get_stride();
+			for (int32_t x = x1; x < x2; x += CHUNK)
+			{
+				int32_t count = std::min(x2 - x, CHUNK);
+				int64_t u = u_row + x * du_x;
+				int64_t v = v_row + x * dv_x;
+
+				// opaque draws sample straight into the target, the others go through the row kernels
+				Pixel* out = MODE == Pixel::Mode::NORMAL ? dst + x : buffer;
+				if (filter == Sprite::BILINEAR)
+					sample_bilinear_row(sprite, out, count, u, v, du_x, dv_x);
+				else
+					sample_nearest_row(sprite, out, count, u, v, du_x, dv_x);
+
+				if (out == buffer)
+					row_write(dst + x, buffer, count, mode, sprite->is_premultiplied());
+			}
+		}
+	}
+
+	// shape walkers, emit pixels through plot(x, y) or scanlines through span(x1, x2, y)
+	template<typename PLOT>
+	static void circle_walk(int32_t x, int32_t y, int32_t radius, PLOT plot)
+	{
+		int x0 = 0;
+		int y0 = radius;
+		int d = 3 - 2 * radius;
+		if (!radius) return;
+
+		while (y0 >= x0) // only formulate 1/8 of circle
+		{
+			plot(x - x0, y - y0);//upper left left
+			plot(x - y0, y - x0);//upper upper left
+			plot(x + y0, y - x0);//upper upper right
+			plot(x + x0, y - y0);//upper right right
+			plot(x - x0, y + y0);//lower left left
+			plot(x - y0, y + x0);//lower lower left
+			plot(x + y0, y + x0);//lower lower right
+			plot(x + x0, y + y0);//lower right right
+			if (d < 0) d += 4 * x0++ + 6;
+			else d += 4 * (x0++ - y0--) + 10;
+		}
+	}
+
+	template<typename SPAN>
+	static void fill_circle_walk(int32_t x, int32_t y, int32_t radius, SPAN span)
+	{
+		// Taken from wikipedia
+		int x0 = 0;
+		int y0 = radius;
+		int d = 3 - 2 * radius;
+		if (!radius) return;
+
+		while (y0 >= x0)
+		{
+			// Modified to draw scan-lines instead of edges
+			// each row is emitted once, at its widest, so translucent fills don't stack
+			span(x - y0, x + y0, y - x0);
+			if (x0 > 0) span(x - y0, x + y0, y + x0);
+			if (d < 0) d += 4 * x0++ + 6;
+			else
+			{
+				if (x0 != y0)
+				{
+					span(x - x0, x + x0, y - y0);
+					span(x - x0, x + x0, y + y0);
+				}
+				d += 4 * (x0++ - y0--) + 10;
+			}
+		}
+	}
+
+	// triangle corners are snapped to 1/16 pixel, coverage is tested in square blocks of pixels
+	static const int32_t EDGE_SHIFT = 4;
+	static const int64_t EDGE_ONE = (int64_t)1 << EDGE_SHIFT;
+	static const int32_t EDGE_BLOCK = 8;
+
+#if defined(MELODY_SSE2) || defined(MELODY_AVX2)
+	// an edge function at the pixels 0 - 3 and 4 - 7 of a block row
+	static inline void edge_lanes(int64_t e, int64_t step, __m128i& lo, __m128i& hi)
+	{
+		int32_t e32 = (int32_t)e;
+		int32_t step32 = (int32_t)step;
+		lo = _mm_setr_epi32(e32, e32 + step32, e32 + 2 * step32, e32 + 3 * step32);
+		hi = _mm_add_epi32(lo, _mm_set1_epi32(4 * step32));
+	}
+#endif
+
+	// coverage of the first rows of a block the edges in cuts pass through, bit i of masks[r] is pixel i of row r.
+	// e is each edge function at the block's top left pixel, narrow says every value fits 32 bits
+	// so the edges can be stepped down the rows four pixels at a time
+	static inline void block_masks(const int64_t* e, const int64_t* A, const int64_t* B, const int32_t* cuts, int32_t cut_count,
+		int32_t rows, bool narrow, uint32_t* masks)
+	{
+#if defined(MELODY_SSE2) || defined(MELODY_AVX2)
+		if (narrow)
+		{
+			// edges that miss the block stay at zero, inside, so three are always stepped without branching
+			__m128i lo[3], hi[3], down[3];
+			for (int32_t i = 0; i < 3; i++)
+				lo[i] = hi[i] = down[i] = _mm_setzero_si128();
+			for (int32_t n = 0; n < cut_count; n++)
+			{
+				int32_t i = cuts[n];
+				edge_lanes(e[i], A[i], lo[n], hi[n]);
+				down[n] = _mm_set1_epi32((int32_t)B[i]);
+			}
+			__m128i lo0 = lo[0], hi0 = hi[0], down0 = down[0];
+			__m128i lo1 = lo[1], hi1 = hi[1], down1 = down[1];
+			__m128i lo2 = lo[2], hi2 = hi[2], down2 = down[2];
+
+			for (int32_t r = 0; r < rows; r++)
+			{
+				// sign bits of the lanes, any negative edge function means outside
+				masks[r] = ~(uint32_t)(_mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(lo0, _mm_or_si128(lo1, lo2))))
+					| _mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(hi0, _mm_or_si128(hi1, hi2)))) << 4) & 0xFF;
+				lo0 = _mm_add_epi32(lo0, down0);
+				hi0 = _mm_add_epi32(hi0, down0);
+				lo1 = _mm_add_epi32(lo1, down1);
+				hi1 = _mm_add_epi32(hi1, down1);
+				lo2 = _mm_add_epi32(lo2, down2);
+				hi2 = _mm_add_epi32(hi2, down2);
+			}
+			return;
+		}
+#endif
+		for (int32_t r = 0; r < rows; r++)
+		{
+			uint32_t mask = (1u << EDGE_BLOCK) - 1;
+			for (int32_t n = 0; n < cut_count; n++)
+			{
+				int32_t i = cuts[n];
+				int64_t value = e[i] + B[i] * r;
+				for (int32_t x = 0; x < EDGE_BLOCK; x++, value += A[i])
+					if (value < 0)
+						mask &= ~(1u << x);
+			}
+			masks[r] = mask;
+		}
+	}
+
+	// nearest 1/16 pixel, halves away from zero
+	static inline int64_t round_to_edge(float f)
+	{
+		double scaled = (double)f * EDGE_ONE;
+		return (int64_t)(scaled + (scaled < 0.0 ? -0.5 : 0.5));
+	}
+
+	// index of the lowest and highest set bit of a non zero mask
+	static inline int32_t lowest_bit(uint32_t mask)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return (int32_t)index;
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+
+	static inline int32_t highest_bit(uint32_t mask)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanReverse(&index, mask);
+		return (int32_t)index;
+#else
+		return 31 - __builtin_clz(mask);
+#endif
+	}
+
+	// narrows [k1, k2] to the k where value + step * k >= 0. the bound is guessed with inverse, 1 / step,
+	// and made exact after, as divides cost more than the rest of a small triangle
+	static inline void block_range(int64_t value, int64_t step, double inverse, int64_t& k1, int64_t& k2)
+	{
+		if (k1 > k2)
+			return;
+
+		if (step > 0)
+		{
+			if (value + step * k2 < 0)
+				k1 = k2 + 1;
+			else if (value + step * k1 < 0)
+			{
+				int64_t k = std::min(std::max((int64_t)(-value * inverse), k1 + 1), k2);
+				while (value + step * k < 0) k++;
+				while (value + step * (k - 1) >= 0) k--;
+				k1 = k;
+			}
+		}
+		else if (step < 0)
+		{
+			if (value + step * k1 < 0)
+				k2 = k1 - 1;
+			else if (value + step * k2 < 0)
+			{
+				int64_t k = std::min(std::max((int64_t)(-value * inverse), k1), k2 - 1);
+				while (value + step * k < 0) k--;
+				while (value + step * (k + 1) >= 0) k++;
+				k2 = k;
+			}
+		}
+		else if (value < 0)
+		{
+			k2 = k1 - 1;
+		}
+	}
+
+	// half-space rasterizer, pixel (x, y) is covered when its centre, at integer coordinates, is inside all three edges.
+	// a centre exactly on an edge goes to the triangle on one side of it only, so meshes cover each pixel once.
+	// blocks outside an edge are never visited and blocks inside all of them need no per pixel tests,
+	// every covered row comes out as one span(x1, x2, y)
+	template<typename SPAN>
+	static void triangle_walk(const ClipRect& clip, float x1, float y1, float x2, float y2, float x3, float y3, SPAN span)
+	{
+		// corners further out could overflow the edge functions
+		const float limit = 1 << 22;
+		const float xs[3] = { x1, x2, x3 };
+		const float ys[3] = { y1, y2, y3 };
+		int64_t X[3], Y[3];
+		for (int32_t i = 0; i < 3; i++)
+		{
+			if (!(std::fabs(xs[i]) <= limit && std::fabs(ys[i]) <= limit))
+				return;
+			X[i] = round_to_edge(xs[i]);
+			Y[i] = round_to_edge(ys[i]);
+		}
+
+		// wind the corners one way round, so inside is where every edge function is positive
+		int64_t area = (X[1] - X[0]) * (Y[2] - Y[0]) - (X[2] - X[0]) * (Y[1] - Y[0]);
+		if (area == 0)
+			return;
+		if (area < 0)
+		{
+			std::swap(X[1], X[2]);
+			std::swap(Y[1], Y[2]);
+		}
+
+		// E(x, y) = A x + B y + C for the edge from corner i to the next, C carries the tie break
+		int64_t A[3], B[3], C[3];
+		bool narrow = true;
+		for (int32_t i = 0; i < 3; i++)
+		{
+			int32_t j = (i + 1) % 3;
+			int64_t dx = X[j] - X[i];
+			int64_t dy = Y[j] - Y[i];
+			A[i] = -dy * EDGE_ONE;
+			B[i] = dx * EDGE_ONE;
+			C[i] = dy * X[i] - dx * Y[i] - (dy < 0 || (dy == 0 && dx > 0) ? 0 : 1);
+			narrow = narrow && std::abs(A[i]) < (1 << 26) && std::abs(B[i]) < (1 << 26);
+		}
+
+		// pixel centres inside the corners' bounds and the clip
+		int64_t min_x = std::min({ X[0], X[1], X[2] }), max_x = std::max({ X[0], X[1], X[2] });
+		int64_t min_y = std::min({ Y[0], Y[1], Y[2] }), max_y = std::max({ Y[0], Y[1], Y[2] });
+		int32_t bx1 = (int32_t)std::max<int64_t>((min_x + EDGE_ONE - 1) >> EDGE_SHIFT, clip.x1);
+		int32_t by1 = (int32_t)std::max<int64_t>((min_y + EDGE_ONE - 1) >> EDGE_SHIFT, clip.y1);
+		int32_t bx2 = (int32_t)std::min<int64_t>(max_x >> EDGE_SHIFT, clip.x2 - 1);
+		int32_t by2 = (int32_t)std::min<int64_t>(max_y >> EDGE_SHIFT, clip.y2 - 1);
+		if (bx1 > bx2 || by1 > by2)
+			return;
+
+		// how far below and above the value at a block's top left corner the edge functions reach inside it
+		const int32_t last = EDGE_BLOCK - 1;
+		int64_t lo_reach[3], hi_reach[3], block_step[3];
+		double inverse_step[3];
+		for (int32_t i = 0; i < 3; i++)
+		{
+			lo_reach[i] = (std::min<int64_t>(A[i], 0) + std::min<int64_t>(B[i], 0)) * last;
+			hi_reach[i] = (std::max<int64_t>(A[i], 0) + std::max<int64_t>(B[i], 0)) * last;
+			block_step[i] = A[i] * EDGE_BLOCK;
+			inverse_step[i] = block_step[i] ? 1.0 / block_step[i] : 0.0;
+		}
+
+		// blocks start at the top left of the box, the tests are exact wherever they sit
+		int64_t block_count = (bx2 - bx1) / EDGE_BLOCK + 1;
+		int32_t row_x1[EDGE_BLOCK], row_x2[EDGE_BLOCK];
+
+		for (int32_t block_y = by1; block_y <= by2; block_y += EDGE_BLOCK)
+		{
+			int32_t rows = std::min(by2 - block_y + 1, EDGE_BLOCK);
+
+			// blocks k along the row that some edge could reach into, and those inside every edge,
+			// solved from each edge's value growing by block_step per block
+			int64_t e[3];
+			int64_t k1 = 0, k2 = block_count - 1;
+			int64_t inside1 = 0, inside2 = block_count - 1;
+			for (int32_t i = 0; i < 3; i++)
+			{
+				e[i] = A[i] * bx1 + B[i] * block_y + C[i];
+				block_range(e[i] + hi_reach[i], block_step[i], inverse_step[i], k1, k2);
+				block_range(e[i] + lo_reach[i], block_step[i], inverse_step[i], inside1, inside2);
+			}
+			if (k1 > k2)
+				continue;
+			if (inside1 > inside2)
+			{
+				inside1 = k2 + 1;
+				inside2 = k2;
+			}
+
+			for (int32_t r = 0; r < rows; r++)
+			{
+				row_x1[r] = INT32_MAX;
+				row_x2[r] = INT32_MIN;
+			}
+
+			// whole blocks need no tests
+			if (inside1 <= inside2)
+			{
+				int32_t x1 = bx1 + (int32_t)inside1 * EDGE_BLOCK;
+				int32_t x2 = std::min(bx1 + (int32_t)inside2 * EDGE_BLOCK + last, bx2);
+				for (int32_t r = 0; r < rows; r++)
+				{
+					row_x1[r] = x1;
+					row_x2[r] = x2;
+				}
+			}
+
+			// the blocks an edge cuts through, either side of the whole ones
+			for (int64_t k = k1; k <= k2; k++)
+			{
+				if (k == inside1)
+					k = inside2 + 1;
+				if (k > k2)
+					break;
+
+				int32_t block_x = bx1 + (int32_t)k * EDGE_BLOCK;
+				int32_t cuts[3];
+				int32_t cut_count = 0;
+				int64_t block_e[3];
+				for (int32_t i = 0; i < 3; i++)
+				{
+					block_e[i] = e[i] + block_step[i] * k;
+					if (block_e[i] + lo_reach[i] < 0)
+						cuts[cut_count++] = i;
+				}
+
+				uint32_t columns = (2u << std::min(bx2 - block_x, last)) - 1;
+				uint32_t masks[EDGE_BLOCK];
+				block_masks(block_e, A, B, cuts, cut_count, rows, narrow, masks);
+				for (int32_t r = 0; r < rows; r++)
+				{
+					uint32_t mask = masks[r] & columns;
+					if (!mask)
+						continue;
+
+					// covered pixels in a row of a convex shape are one run
+					row_x1[r] = std::min(row_x1[r], block_x + lowest_bit(mask));
+					row_x2[r] = std::max(row_x2[r], block_x + highest_bit(mask));
+				}
+			}
+
+			for (int32_t r = 0; r < rows; r++)
+				if (row_x1[r] <= row_x2[r])
+					span(row_x1[r], row_x2[r], block_y + r);
+		}
+	}
+
+	// a value across a triangle in 16.16 fixed point, c + dx * x + dy * y at pixel (x, y).
+	// whole numbers step along a row to the same values from wherever it starts, so tiles agree with a whole target draw
+	struct Plane
+	{
+		int64_t c, dx, dy;
+
+		int64_t at(int32_t x, int32_t y) const
+		{
+			return c + dx * x + dy * y;
+		}
+	};
+
+	// fits planes through the corners' values, the position terms are shared by every value
+	struct PlaneFit
+	{
+		double x0, y0, x1, y1, x2, y2;
+		double inverse = 0.0;
+
+		PlaneFit(const Vertex* v)
+			: x0(v[0].x), y0(v[0].y), x1((double)v[1].x - v[0].x), y1((double)v[1].y - v[0].y), x2((double)v[2].x - v[0].x), y2((double)v[2].y - v[0].y)
+		{
+			double det = x1 * y2 - x2 * y1;
+			if (det != 0.0)
+				inverse = 1.0 / det;
+		}
+
+		// bias is added to every value, limits keep c + dx * x + dy * y in 64 bits for any corner the rasterizer accepts
+		Plane fit(double a0, double a1, double a2, int64_t bias = 0) const
+		{
+			double dx = ((a1 - a0) * y2 - (a2 - a0) * y1) * inverse;
+			double dy = ((a2 - a0) * x1 - (a1 - a0) * x2) * inverse;
+			double c = a0 - dx * x0 - dy * y0;
+			Plane p = { to_fixed(c, 60) + bias, to_fixed(dx, 36), to_fixed(dy, 36) };
+			return p;
+		}
+
+		static int64_t to_fixed(double f, int32_t limit_bits)
+		{
+			double limit = (double)((int64_t)1 << limit_bits);
+			f *= SAMPLE_ONE;
+			return !(f > -limit) ? -(int64_t)limit : f < limit ? (int64_t)(f + (f < 0.0 ? -0.5 : 0.5)) : (int64_t)limit;
+		}
+	};
+
+	// colours along a row, channel k of pixel i is (value[k] + dx[k] * i) >> 16 clamped to 0 - 255
+	static inline void plane_color_row(Pixel* out, int32_t count, const int64_t* value, const int64_t* dx)
+	{
+		int32_t i = 0;
+#if defined(MELODY_SSE2) || defined(MELODY_AVX2)
+		// four pixels a step in 32 bit lanes when the row cannot leave them, packing saturates to the channel range
+		const int64_t lane_limit = (int64_t)1 << 30;
+		bool narrow = true;
+		for (int32_t k = 0; k < 4; k++)
+			narrow = narrow && std::abs(value[k]) < lane_limit && std::abs(dx[k]) * (count + 4) < lane_limit;
+
+		if (narrow)
+		{
+			__m128i lanes[4], step[4];
+			for (int32_t k = 0; k < 4; k++)
+			{
+				int32_t v = (int32_t)value[k];
+				int32_t d = (int32_t)dx[k];
+				lanes[k] = _mm_setr_epi32(v, v + d, v + 2 * d, v + 3 * d);
+				step[k] = _mm_set1_epi32(4 * d);
+			}
+
+			for (; i < count; i += 4)
+			{
+				__m128i rg = _mm_packs_epi32(_mm_srai_epi32(lanes[0], SAMPLE_SHIFT), _mm_srai_epi32(lanes[1], SAMPLE_SHIFT));
+				__m128i ba = _mm_packs_epi32(_mm_srai_epi32(lanes[2], SAMPLE_SHIFT), _mm_srai_epi32(lanes[3], SAMPLE_SHIFT));
+				// r0 b0 r1 b1 .. and g0 a0 g1 a1 .. interleave to r g b a per pixel
+				__m128i rb = _mm_unpacklo_epi16(rg, ba);
+				__m128i ga = _mm_unpackhi_epi16(rg, ba);
+				__m128i pixels = _mm_packus_epi16(_mm_unpacklo_epi16(rb, ga), _mm_unpackhi_epi16(rb, ga));
+				if (i + 4 <= count)
+					_mm_storeu_si128((__m128i*)(out + i), pixels);
+				else
+				{
+					uint32_t last[4];
+					_mm_storeu_si128((__m128i*)last, pixels);
+					for (int32_t n = 0; n < count - i; n++)
+						out[i + n].n = last[n];
+				}
+
+				for (int32_t k = 0; k < 4; k++)
+					lanes[k] = _mm_add_epi32(lanes[k], step[k]);
+			}
+		}
+#endif
+		auto channel = [](int64_t f) { return (uint8_t)std::min<int64_t>(std::max<int64_t>(f >> SAMPLE_SHIFT, 0), 255); };
+		for (; i < count; i++)
+			out[i] = Pixel(channel(value[0] + dx[0] * i), channel(value[1] + dx[1] * i), channel(value[2] + dx[2] * i), channel(value[3] + dx[3] * i));
+	}
+
+	// dst channels multiplied by the ones in src
+	static inline void modulate_row(Pixel* dst, const Pixel* src, int32_t count)
+	{
+		int32_t i = 0;
+#if defined(MELODY_SSE2) || defined(MELODY_AVX2)
+		__m128i zero = _mm_setzero_si128();
+		__m128i round = _mm_set1_epi16(128);
+		for (; i + 2 <= count; i += 2)
+		{
+			__m128i d = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(dst + i)), zero);
+			__m128i s = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(src + i)), zero);
+			__m128i x = _mm_add_epi16(_mm_mullo_epi16(d, s), round);
+			x = _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+			_mm_storel_epi64((__m128i*)(dst + i), _mm_packus_epi16(x, x));
+		}
+#endif
+		for (; i < count; i++)
+		{
+			dst[i].r = (uint8_t)div255(dst[i].r * src[i].r);
+			dst[i].g = (uint8_t)div255(dst[i].g * src[i].g);
+			dst[i].b = (uint8_t)div255(dst[i].b * src[i].b);
+			dst[i].a = (uint8_t)div255(dst[i].a * src[i].a);
+		}
+	}
+
+	// inclusive pixel bounds of a triangle, clamped so far away corners still convert
+	static void vertex_bounds(const Vertex& v1, const Vertex& v2, const Vertex& v3, int32_t& bx1, int32_t& by1, int32_t& bx2, int32_t& by2)
+	{
+		const float limit = 1 << 28;
+		auto clamp = [&](float f) { return !(f > -limit) ? -limit : std::min(f, limit); };
+		bx1 = (int32_t)std::floor(clamp(std::min({ v1.x, v2.x, v3.x })));
+		by1 = (int32_t)std::floor(clamp(std::min({ v1.y, v2.y, v3.y })));
+		bx2 = (int32_t)std::ceil(clamp(std::max({ v1.x, v2.x, v3.x })));
+		by2 = (int32_t)std::ceil(clamp(std::max({ v1.y, v2.y, v3.y })));
+	}
+
+	// colour interpolated from the corners, or the sprite mapped by their u, v and tinted by their colour
+	template<Pixel::Mode MODE>
+	static void shaded_triangle_write(Sprite* target, ModeTag<MODE> mode, const ClipRect& clip, const Vertex& v1, const Vertex& v2, const Vertex& v3,
+		const Sprite* sprite, Sprite::Filter filter)
+	{
+		if (sprite && (!sprite->get_data() || sprite->_width <= 0 || sprite->_height <= 0))
+			return;
+
+		const Vertex v[3] = { v1, v2, v3 };
+
+		// r g b a in memory order, rounded to nearest by the bias
+		PlaneFit planes(v);
+		Plane color[4];
+		for (int32_t k = 0; k < 4; k++)
+			color[k] = planes.fit(v[0].color.n >> 8 * k & 0xFF, v[1].color.n >> 8 * k & 0xFF, v[2].color.n >> 8 * k & 0xFF, SAMPLE_ONE / 2);
+		const int64_t color_dx[4] = { color[0].dx, color[1].dx, color[2].dx, color[3].dx };
+		bool tint = !sprite || v[0].color.n != WHITE.n || v[1].color.n != WHITE.n || v[2].color.n != WHITE.n;
+		bool premultiplied = sprite && sprite->is_premultiplied();
+
+		// texture coordinates in sprite pixels, clamped inside its edges
+		int64_t w = sprite ? sprite->_width : 0;
+		int64_t h = sprite ? sprite->_height : 0;
+		Plane u = {}, t = {};
+		if (sprite)
+		{
+			u = planes.fit((double)v[0].u * w, (double)v[1].u * w, (double)v[2].u * w);
+			t = planes.fit((double)v[0].v * h, (double)v[1].v * h, (double)v[2].v * h);
+		}
+		int64_t u_max = w * SAMPLE_ONE - 1;
+		int64_t v_max = h * SAMPLE_ONE - 1;
+
+		// short, as small triangles are common and the buffers are set up on every call
+		const int32_t CHUNK = 64;
+		Pixel buffer[CHUNK];
+		Pixel colors[CHUNK];
+
+		triangle_walk(clip, v[0].x, v[0].y, v[1].x, v[1].y, v[2].x, v[2].y, [&](int32_t x1, int32_t x2, int32_t y)
+		{
+			Pixel* dst = target->get_data() + y * target->get_stride();
+			for (int32_t x = x1; x <= x2; x += CHUNK)
+			{
+				int32_t count = std::min(x2 - x + 1, CHUNK);
+				int64_t color_at[4] = { color[0].at(x, y), color[1].at(x, y), color[2].at(x, y), color[3].at(x, y) };
+				if (!sprite)
+				{
+					plane_color_row(buffer, count, color_at, color_dx);
+					row_write(dst + x, buffer, count, mode);
+					continue;
+				}
+
+				// rows that stay inside the sprite are sampled in one go
+				int64_t su = u.at(x, y), sv = t.at(x, y);
+				int64_t su_end = su + u.dx * (count - 1), sv_end = sv + t.dx * (count - 1);
+				bool inside = std::min(su, su_end) >= 0 && std::max(su, su_end) <= u_max && std::min(sv, sv_end) >= 0 && std::max(sv, sv_end) <= v_max;
+				for (int32_t i = 0; i < count; i += inside ? count : 1)
+				{
+					int32_t n = inside ? count : 1;
+					int64_t pu = std::min(std::max(su + u.dx * i, (int64_t)0), u_max);
+					int64_t pv = std::min(std::max(sv + t.dx * i, (int64_t)0), v_max);
+					if (filter == Sprite::BILINEAR)
+						sample_bilinear_row(sprite, buffer + i, n, pu, pv, u.dx, t.dx);
+					else
+						sample_nearest_row(sprite, buffer + i, n, pu, pv, u.dx, t.dx);
+				}
+
+				if (tint)
+				{
+					// a premultiplied texel takes the tint's alpha in its colour too
+					plane_color_row(colors, count, color_at, color_dx);
+					if (premultiplied)
+						premultiply_row(colors, count);
+					modulate_row(buffer, colors, count);
+				}
+				row_write(dst + x, buffer, count, mode, premultiplied);
+			}
+		});
+	}
+
+	// recorded draw call, replayed once per tile it touches
+	struct DrawCommand
+	{
+		enum Type : uint8_t
+		{
+			PIXEL, LINE, LINE_AA, CIRCLE, FILL_CIRCLE, FILL_RECT, FILL_TRIANGLE, SHADED_TRIANGLE, SPRITE, RESIZED_SPRITE, TRANSFORMED_SPRITE
+		};
+
+		Type type;
+		Pixel::Mode mode;
+		Pixel p;
+		union
+		{
+			int32_t v[6];	// the corners of a shaded triangle are indices of recorded vertices
+			float f[6];		// end points of an anti-aliased line, transform of a transformed sprite as a b c d tx ty
+		};
+		const Sprite* sprite;
+		Sprite::Filter filter;
+	};
+
+	class TileRenderer
+	{
+	public:
+		TileRenderer(uint32_t thread_count, int32_t tile_size)
+		{
+			_tile_size = tile_size > 0 ? tile_size : 64;
+
+			// the recording thread works through tiles too, so it counts as one of the threads
+			if (thread_count == 0)
+				thread_count = std::max(1u, std::thread::hardware_concurrency());
+			for (uint32_t i = 1; i < thread_count; i++)
+				_workers.emplace_back(&TileRenderer::worker, this);
+		}
+
+		~TileRenderer()
+		{
+			release_used();
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_quit = true;
+			}
+			_start.notify_all();
+			for (auto& t : _workers)
+				t.join();
+		}
+
+		bool empty() const
+		{
+			return _commands.empty();
+		}
+
+		// corners of recorded triangles, commands refer to them by index until the next execute
+		uint32_t add_vertices(const Vertex* v, uint32_t count)
+		{
+			uint32_t index = (uint32_t)_vertices.size();
+			_vertices.insert(_vertices.end(), v, v + count);
+			return index;
+		}
+
+		void record(Sprite* target, const DrawCommand& c, int32_t bx1, int32_t by1, int32_t bx2, int32_t by2)
+		{
+			// bounds are inclusive, clip them to the target and drop anything off it
+			bx1 = std::max(bx1, 0);
+			by1 = std::max(by1, 0);
+			bx2 = std::min(bx2, target->_width - 1);
+			by2 = std::min(by2, target->_height - 1);
+			if (bx1 > bx2 || by1 > by2)
+				return;
+
+			if (_target != target)
+			{
+				_target = target;
+				_tiles_x = (target->_width + _tile_size - 1) / _tile_size;
+				_tiles_y = (target->_height + _tile_size - 1) / _tile_size;
+				_bins.resize(_tiles_x * _tiles_y);
+			}
+
+			uint32_t index = (uint32_t)_commands.size();
+			_commands.push_back(c);
+			use(target);
+			if (c.sprite)
+				use(c.sprite);
+
+			for (int32_t ty = by1 / _tile_size; ty <= by2 / _tile_size; ty++)
+				for (int32_t tx = bx1 / _tile_size; tx <= bx2 / _tile_size; tx++)
+					_bins[ty * _tiles_x + tx].push_back(index);
+		}
+
+		void execute()
+		{
+			if (_commands.empty())
+				return;
+
+			// the workers use the sprites from here on without running anything again
+			release_used();
+
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_next_tile = 0;
+				_busy = (uint32_t)_workers.size();
+				_generation++;
+			}
+			_start.notify_all();
+
+			run_tiles();
+
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_done.wait(lock, [this] { return _busy == 0; });
+			}
+
+			// keep the bin capacity for the next frame
+			_commands.clear();
+			_vertices.clear();
+			for (auto& bin : _bins)
+				bin.clear();
+		}
+
+		// the sprite is read or written by a recorded command, changing it runs them first
+		void use(const Sprite* sprite)
+		{
+			if (sprite->_reader == this)
+				return;
+			if (sprite->_reader)
+				sprite->_reader->execute();
+			sprite->_reader = this;
+			_used.push_back(sprite);
+		}
+
+	private:
+		void release_used()
+		{
+			for (const Sprite* sprite : _used)
+				sprite->_reader = nullptr;
+			_used.clear();
+		}
+
+		void worker()
+		{
+			MELODY_THREAD_NAME("tile worker");
+			uint64_t seen = 0;
+			while (true)
+			{
+				{
+					std::unique_lock<std::mutex> lock(_mutex);
+					_start.wait(lock, [&] { return _quit || _generation != seen; });
+					if (_quit)
+						return;
+					seen = _generation;
+				}
+
+				run_tiles();
+
+				std::lock_guard<std::mutex> lock(_mutex);
+				if (--_busy == 0)
+					_done.notify_one();
+			}
+		}
+
+		void run_tiles()
+		{
+			MELODY_ZONE("tiles");
+			int32_t tile_count = _tiles_x * _tiles_y;
+			int32_t t;
+			while ((t = _next_tile++) < tile_count)
+			{
+				const std::vector<uint32_t>& bin = _bins[t];
+				if (bin.empty())
+					continue;
+
+				int32_t tx = (t % _tiles_x) * _tile_size;
+				int32_t ty = (t / _tiles_x) * _tile_size;
+				ClipRect clip = { tx, ty, std::min(tx + _tile_size, _target->_width), std::min(ty + _tile_size, _target->_height) };
+
+				for (uint32_t index : bin)
+					run_command(_commands[index], clip);
+			}
+		}
+
+		void run_command(const DrawCommand& c, const ClipRect& clip)
+		{
+			with_mode(c.mode, [&](auto mode) { run_command(c, clip, mode); });
+		}
+
+		template<Pixel::Mode MODE>
+		void run_command(const DrawCommand& c, const ClipRect& clip, ModeTag<MODE> mode)
+		{
+			Sprite* target = _target;
+			const int32_t* v = c.v;
+			auto plot = [&](int32_t x, int32_t y) { pixel_write(target, mode, clip, x, y, c.p); };
+			auto span = [&](int32_t x1, int32_t x2, int32_t y) { span_write(target, mode, clip, x1, x2, y, c.p); };
+
+			switch (c.type)
+			{
+			case DrawCommand::PIXEL:			plot(v[0], v[1]);											break;
+			case DrawCommand::LINE:				line_write(target, mode, clip, v[0], v[1], v[2], v[3], c.p, (v[4] & 1) != 0, (v[4] & 2) != 0);	break;
+			case DrawCommand::LINE_AA:			line_aa_write(target, clip, c.f[0], c.f[1], c.f[2], c.f[3], c.p);	break;
+			case DrawCommand::CIRCLE:			circle_walk(v[0], v[1], v[2], plot);						break;
+			case DrawCommand::FILL_CIRCLE:		fill_circle_walk(v[0], v[1], v[2], span);					break;
+			case DrawCommand::FILL_RECT:		rect_write(target, mode, clip, v[0], v[1], v[2], v[3], c.p);	break;
+			case DrawCommand::FILL_TRIANGLE:	triangle_walk(clip, (float)v[0], (float)v[1], (float)v[2], (float)v[3], (float)v[4], (float)v[5], span);	break;
+			case DrawCommand::SHADED_TRIANGLE:	shaded_triangle_write(target, mode, clip, _vertices[v[0]], _vertices[v[1]], _vertices[v[2]], c.sprite, c.filter);	break;
+			case DrawCommand::SPRITE:			blit_write(target, mode, clip, v[0], v[1], c.sprite, v[2], v[3], v[4], v[5]);	break;
+			case DrawCommand::RESIZED_SPRITE:	resize_write(target, mode, clip, v[0], v[1], v[2], v[3], c.sprite, (Sprite::Flip)v[4]);	break;
+			case DrawCommand::TRANSFORMED_SPRITE:
+				transform_write(target, mode, clip, c.sprite, Transform{ c.f[0], c.f[1], c.f[2], c.f[3], c.f[4], c.f[5] }, c.filter);
+				break;
+			}
+		}
+
+	private:
+		int32_t _tile_size = 64;
+		int32_t _tiles_x = 0;
+		int32_t _tiles_y = 0;
+		Sprite* _target = nullptr;
+		std::vector<DrawCommand> _commands;
+		std::vector<Vertex> _vertices;
+		std::vector<const Sprite*> _used;
+		std::vector<std::vector<uint32_t>> _bins;
+
+		std::vector<std::thread> _workers;
+		std::mutex _mutex;
+		std::condition_variable _start;
+		std::condition_variable _done;
+		std::atomic<int32_t> _next_tile{ 0 };
+		uint32_t _busy = 0;
+		uint64_t _generation = 0;
+		bool _quit = false;
+	};
+
+	void Sprite::settle() const
+	{
+		if (_reader)
+			_reader->execute();
+	}
+
+	Engine::Engine()
+	{
+		_app_name = "Melody";
+	}
+
+	Engine::~Engine()
+	{
+		delete _tile_renderer;
+		delete _layer_compositor;
+		for (Layer& layer : _layers)
+			delete layer.sprite;
+
+#ifdef _WIN32
+		// the primary screen is one of the rotating buffers once presentation has started
+		if (!_screens.empty())
+		{
+			for (ScreenBuffer& screen : _screens)
+				delete screen.sprite;
+			return;
+		}
+#endif
+		delete _default_drawing_target;
+	}
+
+	void Engine::set_frame_history(uint32_t frames, std::string csv_file)
+	{
+		std::lock_guard<std::mutex> lock(_stats_mutex);
+		_frame_history_size = std::max(frames, 1u);
+		_frame_history.clear();
+		_frames_recorded = 0;
+		_frame_csv_file = csv_file;
+	}
+
+	void Engine::record_frame(const FrameTimings& timings)
+	{
+		std::lock_guard<std::mutex> lock(_stats_mutex);
+		if (_frame_history.size() < _frame_history_size)
+			_frame_history.push_back(timings);
+		else
+			_frame_history[_frames_recorded % _frame_history_size] = timings;
+		_frames_recorded++;
+	}
+
+	FrameStats Engine::get_frame_stats(FrameStats::Phase phase) const
+	{
+		FrameStats stats;
+		if (phase < 0 || phase >= FrameStats::PHASE_COUNT)
+			return stats;
+
+		std::vector<float> samples;
+		{
+			std::lock_guard<std::mutex> lock(_stats_mutex);
+			samples.reserve(_frame_history.size());
+			for (const FrameTimings& t : _frame_history)
+				samples.push_back(t.phase[phase]);
+		}
+
+		if (samples.empty())
+			return stats;
+
+		double sum = 0.0;
+		for (float v : samples)
+			sum += v;
+		stats.avg = (float)(sum / samples.size());
+
+		// nearest rank, each selection leaves the smaller samples in front of it
+		auto percentile = [&](float p)
+		{
+			size_t rank = (size_t)std::ceil(p * samples.size());
+			size_t n = rank > 0 ? rank - 1 : 0;
+			std::nth_element(samples.begin(), samples.begin() + n, samples.end());
+			return samples[n];
+		};
+
+		stats.min = *std::min_element(samples.begin(), samples.end());
+		stats.max = *std::max_element(samples.begin(), samples.end());
+		stats.p50 = percentile(0.50f);
+		stats.p95 = percentile(0.95f);
+		stats.p99 = percentile(0.99f);
+		return stats;
+	}
+
+	void Engine::write_frame_csv() const
+	{
+		std::lock_guard<std::mutex> lock(_stats_mutex);
+		if (_frame_csv_file.empty())
+			return;
+
+		std::ofstream file(_frame_csv_file);
+		if (!file)
+			return;
+
+		// oldest frame first, times in milliseconds
+		file << "frame,input,update,upload,present,frame_time\n";
+		uint64_t count = _frame_history.size();
+		uint64_t first = _frames_recorded - count;
+		for (uint64_t i = 0; i < count; i++)
+		{
+			const FrameTimings& t = _frame_history[(first + i) % _frame_history_size];
+			file << first + i;
+			for (int k = 0; k < FrameStats::PHASE_COUNT; k++)
+				file << "," << t.phase[k] * 1000.0f;
+			file << "\n";
+		}
+	}
+
+	void Engine::set_frames_in_flight(uint32_t frames)
+	{
+		_frames_in_flight = std::min(frames, 2u);
+	}
+
+	void Engine::set_fixed_timestep(float step, uint32_t max_steps)
+	{
+		_fixed_timestep = std::max(step, 0.0f);
+		_max_fixed_steps = std::max(max_steps, 1u);
+		_step_accumulator = 0.0f;
+		_interpolation = 0.0f;
+	}
+
+	float Engine::get_interpolation() const
+	{
+		return _interpolation;
+	}
+
+	void Engine::set_frame_rate_limit(float fps)
+	{
+		_frame_rate_limit = std::max(fps, 0.0f);
+	}
+
+	void Engine::set_vsync(bool enable)
+	{
+		_vsync = enable;
+	}
+
+	void Engine::set_tiled_rendering(bool enable, uint32_t thread_count, int32_t tile_size)
+	{
+		flush();
+		delete _tile_renderer;
+		_tile_renderer = enable ? new TileRenderer(thread_count, tile_size) : nullptr;
+	}
+
+	void Engine::flush()
+	{
+		if (!_tile_renderer || _tile_renderer->empty())
+			return;
+
+		MELODY_ZONE("flush");
+		_tile_renderer->execute();
+	}
+
+	void Engine::record(const DrawCommand& c, int32_t bx1, int32_t by1, int32_t bx2, int32_t by2)
+	{
+		if (!_drawing_target)
+			return;
+
+		mark_dirty(bx1, by1, bx2, by2);
+		_tile_renderer->record(_drawing_target, c, bx1, by1, bx2, by2);
+	}
+
+	void Engine::mark_dirty(int32_t bx1, int32_t by1, int32_t bx2, int32_t by2)
+	{
+		// only the primary screen is uploaded and only layers are composited into it, bounds are inclusive
+		if (_drawing_target == _default_drawing_target)
+			mark_cells(_dirty_cells, bx1, by1, bx2, by2);
+		else if (_drawing_layer >= 0)
+		{
+			Layer& layer = _layers[_drawing_layer];
+			mark_cells(layer.changed, bx1, by1, bx2, by2);
+			mark_cells(layer.used, bx1, by1, bx2, by2);
+		}
+	}
+
+	void Engine::mark_cells(std::vector<uint8_t>& cells, int32_t bx1, int32_t by1, int32_t bx2, int32_t by2)
+	{
+		bx1 = std::max(bx1, 0);
+		by1 = std::max(by1, 0);
+		bx2 = std::min(bx2, (int32_t)_screen_width - 1);
+		by2 = std::min(by2, (int32_t)_screen_height - 1);
+		if (bx1 > bx2 || by1 > by2)
+			return;
+
+		for (int32_t cy = by1 / DIRTY_CELL; cy <= by2 / DIRTY_CELL; cy++)
+			for (int32_t cx = bx1 / DIRTY_CELL; cx <= bx2 / DIRTY_CELL; cx++)
+				cells[cy * _dirty_cells_x + cx] = 1;
+	}
+
+	void Engine::invalidate(int32_t x, int32_t y, int32_t w, int32_t h)
+	{
+		Sprite* target = _drawing_target;
+		_drawing_target = _default_drawing_target;
+		mark_dirty(x, y, x + w - 1, y + h - 1);
+		_drawing_target = target;
+	}
+
+	void Engine::update_dirty_rects()
+	{
+		MELODY_ZONE("dirty rects");
+		_dirty_rects.clear();
+		_dirty_area = 0;
+
+		for (int32_t cy = 0; cy < _dirty_cells_y; cy++)
+		{
+			uint8_t* cells = &_dirty_cells[cy * _dirty_cells_x];
+			int32_t cx = 0;
+			while (cx < _dirty_cells_x)
+			{
+				if (!cells[cx]) { cx++; continue; }
+
+				// run of dirty cells along the row
+				int32_t run = cx;
+				while (cx < _dirty_cells_x && cells[cx])
+					cells[cx++] = 0;
+
+				DirtyRect r;
+				r.x = run * DIRTY_CELL;
+				r.y = cy * DIRTY_CELL;
+				r.w = std::min(cx * DIRTY_CELL, (int32_t)_screen_width) - r.x;
+				r.h = std::min(r.y + DIRTY_CELL, (int32_t)_screen_height) - r.y;
+
+				// extend a rectangle from the row above when it covers the same columns
+				bool merged = false;
+				for (DirtyRect& above : _dirty_rects)
+				{
+					if (above.x == r.x && above.w == r.w && above.y + above.h == r.y)
+					{
+						above.h += r.h;
+						merged = true;
+						break;
+					}
+				}
+
+				if (!merged)
+					_dirty_rects.push_back(r);
+				_dirty_area += (uint32_t)(r.w * r.h);
+			}
+		}
+	}
+
+	uint32_t Engine::get_dirty_area() const
+	{
+		return _dirty_area;
+	}
+
+	void Engine::set_layer_count(uint32_t count, uint32_t thread_count)
+	{
+		// recorded draws may still be headed for the old layers
+		flush();
+		if (_drawing_layer >= 0)
+			_drawing_target = _default_drawing_target;
+		_drawing_layer = -1;
+
+		for (Layer& layer : _layers)
+			delete layer.sprite;
+		_layers.clear();
+		delete _layer_compositor;
+		_layer_compositor = nullptr;
+
+		if (count == 0 || !_default_drawing_target)
+			return;
+
+		_layer_compositor = new TileRenderer(thread_count, 0);
+		_layers.resize(count);
+		for (Layer& layer : _layers)
+		{
+			layer.sprite = new Sprite(_screen_width, _screen_height);
+			std::fill_n(layer.sprite->get_data(), (size_t)layer.sprite->get_stride() * layer.sprite->_height, Pixel(0, 0, 0, 0));
+			layer.changed.assign(_dirty_cells.size(), 1);
+			layer.used.assign(_dirty_cells.size(), 0);
+		}
+	}
+
+	uint32_t Engine::get_layer_count() const
+	{
+		return (uint32_t)_layers.size();
+	}
+
+	Sprite* Engine::get_layer(uint32_t index)
+	{
+		return index < _layers.size() ? _layers[index].sprite : nullptr;
+	}
+
+	void Engine::set_drawing_layer(uint32_t index)
+	{
+		if (index < _layers.size())
+			set_drawing_target(_layers[index].sprite);
+	}
+
+	void Engine::set_layer_visible(uint32_t index, bool visible)
+	{
+		if (index >= _layers.size() || _layers[index].visible == visible)
+			return;
+
+		Layer& layer = _layers[index];
+		layer.visible = visible;
+		std::fill(layer.changed.begin(), layer.changed.end(), 1);
+	}
+
+	void Engine::set_layer_mode(uint32_t index, Pixel::Mode mode)
+	{
+		if (index >= _layers.size() || _layers[index].mode == mode)
+			return;
+
+		Layer& layer = _layers[index];
+		layer.mode = mode;
+		std::fill(layer.changed.begin(), layer.changed.end(), 1);
+	}
+
+	void Engine::clear_layer(uint32_t index)
+	{
+		if (index >= _layers.size())
+			return;
+
+		// recorded draws into the layer have to land before it is wiped
+		flush();
+
+		Layer& layer = _layers[index];
+		Sprite* sprite = layer.sprite;
+		for (int32_t cy = 0; cy < _dirty_cells_y; cy++)
+			for (int32_t cx = 0; cx < _dirty_cells_x; cx++)
+			{
+				int32_t cell = cy * _dirty_cells_x + cx;
+				if (!layer.used[cell])
+					continue;
+
+				int32_t x = cx * DIRTY_CELL;
+				int32_t w = std::min(x + DIRTY_CELL, sprite->_width) - x;
+				int32_t y2 = std::min((cy + 1) * DIRTY_CELL, sprite->_height);
+				for (int32_t y = cy * DIRTY_CELL; y < y2; y++)
+					std::fill_n(sprite->get_data() + y * sprite->get_stride() + x, w, Pixel(0, 0, 0, 0));
+
+				layer.used[cell] = 0;
+				layer.changed[cell] = 1;
+			}
+	}
+
+	void Engine::invalidate_layer(uint32_t index, int32_t x, int32_t y, int32_t w, int32_t h)
+	{
+		if (index >= _layers.size())
+			return;
+
+		mark_cells(_layers[index].changed, x, y, x + w - 1, y + h - 1);
+		mark_cells(_layers[index].used, x, y, x + w - 1, y + h - 1);
+	}
+
+	void Engine::composite_layers()
+	{
+		if (_layers.empty())
+			return;
+
+		MELODY_ZONE("composite layers");
+
+		// the bottom shown layer covers the black underneath by itself when it is copied in normal mode
+		const Layer* bottom = nullptr;
+		for (const Layer& layer : _layers)
+			if (layer.visible)
+			{
+				bottom = &layer;
+				break;
+			}
+		bool clear = !bottom || bottom->mode != Pixel::Mode::NORMAL;
+
+		Sprite* screen = _default_drawing_target;
+		for (int32_t cy = 0; cy < _dirty_cells_y; cy++)
+		{
+			int32_t cx = 0;
+			while (cx < _dirty_cells_x)
+			{
+				// run of cells along the row where a layer that is or was shown has changed
+				int32_t run = cx;
+				while (cx < _dirty_cells_x)
+				{
+					int32_t cell = cy * _dirty_cells_x + cx;
+					bool changed = false;
+					for (Layer& layer : _layers)
+					{
+						changed = changed || (layer.changed[cell] && (layer.visible || layer.was_visible));
+						layer.changed[cell] = 0;
+					}
+					if (!changed)
+						break;
+
+					_dirty_cells[cell] = 1;
+					cx++;
+				}
+
+				if (cx == run)
+				{
+					cx++;
+					continue;
+				}
+
+				// the same commands drawing would record, so the workers split them up by tile
+				int32_t x = run * DIRTY_CELL;
+				int32_t y = cy * DIRTY_CELL;
+				int32_t w = std::min(cx * DIRTY_CELL, (int32_t)_screen_width) - x;
+				int32_t h = std::min(y + DIRTY_CELL, (int32_t)_screen_height) - y;
+				if (clear)
+					_layer_compositor->record(screen, { DrawCommand::FILL_RECT, Pixel::Mode::NORMAL, BLACK, { x, y, w, h } }, x, y, x + w - 1, y + h - 1);
+				for (const Layer& layer : _layers)
+					if (layer.visible)
+						_layer_compositor->record(screen, { DrawCommand::SPRITE, layer.mode, Pixel(), { x, y, x, y, w, h }, layer.sprite }, x, y, x + w - 1, y + h - 1);
+			}
+		}
+
+		for (Layer& layer : _layers)
+			layer.was_visible = layer.visible;
+		_layer_compositor->execute();
+	}
+
+	ReturnCode Engine::construct(uint32_t screen_w, uint32_t screen_h, uint32_t pixel_w, uint32_t pixel_h)
+	{
+		_screen_width = screen_w;
+		_screen_height = screen_h;
+		_pixel_width = pixel_w;
+		_pixel_height = pixel_h;
+
+#ifdef _WIN32
+		std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+		_window_name = converter.from_bytes(_app_name);
+#endif
+
+		_default_drawing_target = new Sprite(_screen_width, _screen_height);
+		set_drawing_target(nullptr);
+
+		// everything is dirty until the first upload
+		_dirty_cells_x = ((int32_t)_screen_width + DIRTY_CELL - 1) / DIRTY_CELL;
+		_dirty_cells_y = ((int32_t)_screen_height + DIRTY_CELL - 1) / DIRTY_CELL;
+		_dirty_cells.assign(_dirty_cells_x * _dirty_cells_y, 1);
+		return ReturnCode::OK;
+	}
+
+	ReturnCode Engine::Start()
+	{
+#ifndef _WIN32
+		// no window system on this platform, run the same loop headless
+		return start_headless();
+#else
+		if (!create_window())
+			return ReturnCode::FAIL;
+
+		ULONG_PTR token;
+		Gdiplus::GdiplusStartupInput startup_input;
+		Gdiplus::GdiplusStartup(&token, &startup_input, NULL);
+
+		_atom_active = true;
+		std::thread t = std::thread(&Engine::threading, this);
+
+		MSG msg;
+		while (GetMessage(&msg, NULL, 0, 0) > 0)
+		{
+			TranslateMessage(&msg);
+			DispatchMessage(&msg);
+		}
+
+		t.join();
+		return ReturnCode::OK;
+#endif
+	}
+
+	ReturnCode Engine::start_headless(uint32_t frame_count, float fixed_delta_time)
+	{
+		MELODY_THREAD_NAME("game");
+
+		if (!_default_drawing_target)
+			return ReturnCode::FAIL;
+
+		_frame_count = 0;
+		_headless_fps = 0.0f;
+		_atom_active = true;
+
+		// load resources
+		if (!on_awake())
+			_atom_active = false;
+
+		auto time_start = std::chrono::steady_clock::now();
+		auto time_point1 = time_start;
+		auto time_point2 = time_start;
+		_frame_deadline = time_start;
+
+		while (_atom_active)
+		{
+			while (_atom_active)
+			{
+				pace_frame();
+
+				time_point2 = std::chrono::steady_clock::now();
+				std::chrono::duration<float> elapsed_time = time_point2 - time_point1;
+				time_point1 = time_point2;
+
+				float delta_time = fixed_delta_time > 0.0f ? fixed_delta_time : elapsed_time.count();
+
+				FrameTimings timings = {};
+				timings.phase[FrameStats::FRAME] = elapsed_time.count();
+
+				// no window feeds the input queue, but keep the button states consistent
+				if (!update_input_state(delta_time))
+				{
+					_atom_active = false;
+					break;
+				}
+				auto time_input = std::chrono::steady_clock::now();
+				timings.phase[FrameStats::INPUT] = std::chrono::duration<float>(time_input - time_point2).count();
+
+				// frame
+				if (!update_frame(delta_time))
+					_atom_active = false;
+
+				// finish recorded draw calls before the screen is used
+				flush();
+				composite_layers();
+				update_dirty_rects();
+				timings.phase[FrameStats::UPDATE] = std::chrono::duration<float>(std::chrono::steady_clock::now() - time_input).count();
+				record_frame(timings);
+
+				_frame_count++;
+				if (frame_count && _frame_count >= frame_count)
+					_atom_active = false;
+			}
+
+			if (on_destroy())
+			{
+
+			}
+			else
+			{
+				// if abort destroying, continue running
+				// a bounded run cannot be extended, the frame budget is spent
+				_atom_active = frame_count == 0;
+			}
+		}
+
+		std::chrono::duration<double> total_time = std::chrono::steady_clock::now() - time_start;
+		if (total_time.count() > 0.0)
+			_headless_fps = (float)((double)_frame_count / total_time.count());
+
+		std::cout << "Melody - " << _app_name << " - headless: " << _frame_count << " frames in "
+			<< total_time.count() << "s, FPS: " << _headless_fps << std::endl;
+
+		write_frame_csv();
+		_input_record.close();
+
+		return ReturnCode::OK;
+	}
+
+	void Engine::set_drawing_target(Sprite* target)
+	{
+		// recorded calls belong to the old target, and the new one may read from it
+		flush();
+
+		if (target)
+			_drawing_target = target;
+		else
+			_drawing_target = _default_drawing_target;
+
+		// draws into a layer mark its cells instead of the screen's
+		_drawing_layer = -1;
+		for (size_t i = 0; i < _layers.size(); i++)
+			if (_layers[i].sprite == _drawing_target)
+				_drawing_layer = (int32_t)i;
+	}
+
+	Sprite* Engine::get_drawing_target()
+	{
+		return _drawing_target;
+	}
+
+	int32_t Engine::get_drawing_target_width() const
+	{
+		if (_drawing_target)
+			return _drawing_target->_width;
+		else
+			return 0;
+	}
+
+	int32_t Engine::get_drawing_target_height() const
+	{
+		if (_drawing_target)
+			return _drawing_target->_height;
+		else
+			return 0;
+	}
+
+	bool Engine::is_focused() const
+	{
+		return _has_input_focus;
+	}
+
+	ButtonState Engine::get_key(KeyCode key) const
+	{
+		return _keyboard_state[key];
+	}
+
+	ButtonState Engine::get_mouse(char button) const
+	{
+		return _mouse_state[button];
+	}
+
+	int32_t Engine::get_mouse_x() const
+	{
+		return _mouse_pos_x;
+	}
+
+	int32_t Engine::get_mouse_y() const
+	{
+		return _mouse_pos_y;
+	}
+
+	const std::vector<InputEvent>& Engine::get_input_events() const
+	{
+		return _input_events;
+	}
+
+	uint64_t Engine::get_frame_count() const
+	{
+		return _frame_count;
+	}
+
+	float Engine::get_headless_fps() const
+	{
+		return _headless_fps;
+	}
+
+	int32_t Engine::get_screen_width() const
+	{
+		return _screen_width;
+	}
+
+	int32_t Engine::get_screen_height() const
+	{
+		return _screen_height;
+	}
+
+	void Engine::draw_pixel(int32_t x, int32_t y, Pixel p)
+	{
+		if (!_drawing_target)
+			return;
+
+		if (_tile_renderer)
+			return record({ DrawCommand::PIXEL, _pixel_mode, p, { x, y } }, x, y, x, y);
+
+		mark_dirty(x, y, x, y);
+		with_mode(_pixel_mode, [&](auto mode) { pixel_write(_drawing_target, mode, full_clip(_drawing_target), x, y, p); });
+	}
+
+	void Engine::draw_line(int32_t x1, int32_t y1, int32_t x2, int32_t y2, Pixel p)
+	{
+		draw_segment(x1, y1, x2, y2, p, false, false);
+	}
+
+	void Engine::draw_segment(int32_t x1, int32_t y1, int32_t x2, int32_t y2, Pixel p, bool skip_start, bool skip_end)
+	{
+		if (!_drawing_target)
+			return;
+
+		int32_t bx1 = std::min(x1, x2), by1 = std::min(y1, y2), bx2 = std::max(x1, x2), by2 = std::max(y1, y2);
+		if (_tile_renderer)
+			return record({ DrawCommand::LINE, _pixel_mode, p, { x1, y1, x2, y2, (skip_start ? 1 : 0) | (skip_end ? 2 : 0) } }, bx1, by1, bx2, by2);
+
+		mark_dirty(bx1, by1, bx2, by2);
+		with_mode(_pixel_mode, [&](auto mode) { line_write(_drawing_target, mode, full_clip(_drawing_target), x1, y1, x2, y2, p, skip_start, skip_end); });
+	}
+
+	void Engine::draw_line_aa(float x1, float y1, float x2, float y2, Pixel p)
+	{
+		if (!_drawing_target)
+			return;
+
+		int32_t bx1, by1, bx2, by2;
+		line_aa_bounds(x1, y1, x2, y2, bx1, by1, bx2, by2);
+		if (_tile_renderer)
+		{
+			DrawCommand c = { DrawCommand::LINE_AA, _pixel_mode, p };
+			c.f[0] = x1;
+			c.f[1] = y1;
+			c.f[2] = x2;
+			c.f[3] = y2;
+			return record(c, bx1, by1, bx2, by2);
+		}
+
+		mark_dirty(bx1, by1, bx2, by2);
+		line_aa_write(_drawing_target, full_clip(_drawing_target), x1, y1, x2, y2, p);
+	}
+
+	void Engine::draw_polyline(const int32_t* points, uint32_t count, Pixel p, bool closed)
+	{
+		if (points == nullptr || count == 0)
+			return;
+
+		if (count == 1)
+			return draw_segment(points[0], points[1], points[0], points[1], p, false, false);
+
+		// every segment after the first leaves out the point the one before it ended on
+		for (uint32_t i = 0; i + 1 < count; i++)
+			draw_segment(points[i * 2], points[i * 2 + 1], points[i * 2 + 2], points[i * 2 + 3], p, i > 0, false);
+
+		if (closed && count > 2)
+			draw_segment(points[count * 2 - 2], points[count * 2 - 1], points[0], points[1], p, true, true);
+	}
+
+	void Engine::draw_lines(const int32_t* segments, uint32_t count, Pixel p)
+	{
+		if (segments == nullptr)
+			return;
+
+		for (uint32_t i = 0; i < count; i++, segments += 4)
+			draw_segment(segments[0], segments[1], segments[2], segments[3], p, false, false);
+	}
+
+	void Engine::draw_circle(int32_t x, int32_t y, int32_t radius, Pixel p)
+	{
+		if (_tile_renderer)
+			return record({ DrawCommand::CIRCLE, _pixel_mode, p, { x, y, radius } }, x - radius, y - radius, x + radius, y + radius);
+
+		if (!_drawing_target)
+			return;
+
+		mark_dirty(x - radius, y - radius, x + radius, y + radius);
+		ClipRect clip = full_clip(_drawing_target);
+		with_mode(_pixel_mode, [&](auto mode)
+		{
+			circle_walk(x, y, radius, [&](int32_t px, int32_t py) { pixel_write(_drawing_target, mode, clip, px, py, p); });
+		});
+	}
+
+	void Engine::fill_circle(int32_t x, int32_t y, int32_t radius, Pixel p)
+	{
+		if (_tile_renderer)
+			return record({ DrawCommand::FILL_CIRCLE, _pixel_mode, p, { x, y, radius } }, x - radius, y - radius, x + radius, y + radius);
+
+		if (!_drawing_target)
+			return;
+
+		mark_dirty(x - radius, y - radius, x + radius, y + radius);
+		ClipRect clip = full_clip(_drawing_target);
+		with_mode(_pixel_mode, [&](auto mode)
+		{
+			fill_circle_walk(x, y, radius, [&](int32_t sx, int32_t ex, int32_t ny) { span_write(_drawing_target, mode, clip, sx, ex, ny, p); });
+		});
+	}
+
+	void Engine::draw_rect(int32_t x, int32_t y, int32_t w, int32_t h, Pixel p)
+	{
+		const int32_t corners[] = { x, y, x + w, y, x + w, y + h, x, y + h };
+		draw_polyline(corners, 4, p, true);
+	}
+
+	void Engine::fill_rect(int32_t x, int32_t y, int32_t w, int32_t h, Pixel p)
+	{
+		if (!_drawing_target)
+			return;
+
+		if (_tile_renderer)
+			return record({ DrawCommand::FILL_RECT, _pixel_mode, p, { x, y, w, h } }, x, y, x + w - 1, y + h - 1);
+
+		mark_dirty(x, y, x + w - 1, y + h - 1);
+		with_mode(_pixel_mode, [&](auto mode) { rect_write(_drawing_target, mode, full_clip(_drawing_target), x, y, w, h, p); });
+	}
+
+	void Engine::draw_triangle(int32_t x1, int32_t y1, int32_t x2, int32_t y2, int32_t x3, int32_t y3, Pixel p)
+	{
+		const int32_t corners[] = { x1, y1, x2, y2, x3, y3 };
+		draw_polyline(corners, 3, p, true);
+	}
+
+	void Engine::fill_triangle(int32_t x1, int32_t y1, int32_t x2, int32_t y2, int32_t x3, int32_t y3, Pixel p)
+	{
+		if (_tile_renderer)
+			return record({ DrawCommand::FILL_TRIANGLE, _pixel_mode, p, { x1, y1, x2, y2, x3, y3 } },
+				std::min({ x1, x2, x3 }), std::min({ y1, y2, y3 }), std::max({ x1, x2, x3 }), std::max({ y1, y2, y3 }));
+
+		if (!_drawing_target)
+			return;
+
+		mark_dirty(std::min({ x1, x2, x3 }), std::min({ y1, y2, y3 }), std::max({ x1, x2, x3 }), std::max({ y1, y2, y3 }));
+		ClipRect clip = full_clip(_drawing_target);
+		with_mode(_pixel_mode, [&](auto mode)
+		{
+			triangle_walk(clip, (float)x1, (float)y1, (float)x2, (float)y2, (float)x3, (float)y3,
+				[&](int32_t sx, int32_t ex, int32_t ny) { span_write(_drawing_target, mode, clip, sx, ex, ny, p); });
+		});
+	}
+
+	void Engine::fill_triangle(const Vertex& v1, const Vertex& v2, const Vertex& v3)
+	{
+		fill_shaded_triangle(v1, v2, v3, nullptr, Sprite::NEAREST);
+	}
+
+	void Engine::fill_triangle(const Vertex& v1, const Vertex& v2, const Vertex& v3, Sprite* sprite, Sprite::Filter filter)
+	{
+		if (sprite == nullptr)
+			return;
+
+		fill_shaded_triangle(v1, v2, v3, sprite, filter);
+	}
+
+	void Engine::fill_shaded_triangle(const Vertex& v1, const Vertex& v2, const Vertex& v3, const Sprite* sprite, Sprite::Filter filter)
+	{
+		if (!_drawing_target)
+			return;
+
+		int32_t bx1, by1, bx2, by2;
+		vertex_bounds(v1, v2, v3, bx1, by1, bx2, by2);
+
+		if (_tile_renderer && sprite != _drawing_target)
+		{
+			const Vertex v[3] = { v1, v2, v3 };
+			int32_t base = (int32_t)_tile_renderer->add_vertices(v, 3);
+			DrawCommand c = { DrawCommand::SHADED_TRIANGLE, _pixel_mode, Pixel(), { base, base + 1, base + 2 }, sprite, filter };
+			return record(c, bx1, by1, bx2, by2);
+		}
+
+		flush();
+		mark_dirty(bx1, by1, bx2, by2);
+		with_mode(_pixel_mode, [&](auto mode) { shaded_triangle_write(_drawing_target, mode, full_clip(_drawing_target), v1, v2, v3, sprite, filter); });
+	}
+
+	void Engine::draw_mesh(const Vertex* vertices, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count,
+		const Transform& transform, Sprite* sprite, Sprite::Filter filter)
+	{
+		if (!_drawing_target || !vertices || !indices)
+			return;
+
+		// every corner is moved once, however many triangles share it
+		_mesh_vertices.assign(vertices, vertices + vertex_count);
+		for (Vertex& v : _mesh_vertices)
+			transform.apply(v.x, v.y, v.x, v.y);
+
+		bool tiled = _tile_renderer && sprite != _drawing_target;
+		int32_t base = tiled ? (int32_t)_tile_renderer->add_vertices(_mesh_vertices.data(), vertex_count) : 0;
+		if (!tiled)
+			flush();
+
+		Sprite* target = _drawing_target;
+		ClipRect clip = full_clip(target);
+		for (uint32_t i = 0; i + 2 < index_count; i += 3)
+		{
+			uint32_t i1 = indices[i], i2 = indices[i + 1], i3 = indices[i + 2];
+			if (i1 >= vertex_count || i2 >= vertex_count || i3 >= vertex_count)
+				continue;
+
+			const Vertex& v1 = _mesh_vertices[i1];
+			const Vertex& v2 = _mesh_vertices[i2];
+			const Vertex& v3 = _mesh_vertices[i3];
+			int32_t bx1, by1, bx2, by2;
+			vertex_bounds(v1, v2, v3, bx1, by1, bx2, by2);
+
+			if (tiled)
+			{
+				DrawCommand c = { DrawCommand::SHADED_TRIANGLE, _pixel_mode, Pixel(), { base + (int32_t)i1, base + (int32_t)i2, base + (int32_t)i3 }, sprite, filter };
+				record(c, bx1, by1, bx2, by2);
+			}
+			else if (bx2 >= clip.x1 && by2 >= clip.y1 && bx1 < clip.x2 && by1 < clip.y2)
+			{
+				mark_dirty(bx1, by1, bx2, by2);
+				with_mode(_pixel_mode, [&](auto mode) { shaded_triangle_write(target, mode, clip, v1, v2, v3, sprite, filter); });
+			}
+		}
+	}
+
+	void Engine::draw_sprite(int32_t x, int32_t y, Sprite* sprite)
+	{
+		if (sprite == nullptr)
+			return;
+
+		draw_sprite_partial(x, y, sprite, 0, 0, sprite->_width, sprite->_height);
+	}
+
+	void Engine::draw_sprite(int32_t x, int32_t y, Sprite* sprite, int32_t scale, Sprite::Flip flip)
+	{
+		if (sprite == nullptr || scale <= 0)
+			return;
+
+		int64_t w = (int64_t)sprite->_width * scale;
+		int64_t h = (int64_t)sprite->_height * scale;
+		if (w > INT32_MAX || h > INT32_MAX)
+			return;
+
+		draw_sprite(x, y, sprite, (int32_t)w, (int32_t)h, flip);
+	}
+
+	void Engine::draw_sprite(int32_t x, int32_t y, Sprite* sprite, int32_t w, int32_t h, Sprite::Flip flip)
+	{
+		if (sprite == nullptr || !_drawing_target || w <= 0 || h <= 0)
+			return;
+
+		if (_tile_renderer && sprite != _drawing_target)
+			return record({ DrawCommand::RESIZED_SPRITE, _pixel_mode, Pixel(), { x, y, w, h, flip }, sprite }, x, y, x + w - 1, y + h - 1);
+
+		flush();
+		mark_dirty(x, y, x + w - 1, y + h - 1);
+		with_mode(_pixel_mode, [&](auto mode) { resize_write(_drawing_target, mode, full_clip(_drawing_target), x, y, w, h, sprite, flip); });
+	}
+
+	void Engine::draw_sprite_partial(int32_t x, int32_t y, Sprite* sprite, int32_t ox, int32_t oy, int32_t w, int32_t h)
+	{
+		if (sprite == nullptr || !_drawing_target)
+			return;
+
+		// a sprite drawn onto itself reads pixels other tiles are writing, so run it in place
+		if (_tile_renderer && sprite != _drawing_target)
+			return record({ DrawCommand::SPRITE, _pixel_mode, Pixel(), { x, y, ox, oy, w, h }, sprite }, x, y, x + w - 1, y + h - 1);
+
+		flush();
+		mark_dirty(x, y, x + w - 1, y + h - 1);
+		with_mode(_pixel_mode, [&](auto mode) { blit_write(_drawing_target, mode, full_clip(_drawing_target), x, y, sprite, ox, oy, w, h); });
+	}
+
+	void Engine::draw_sprite_transformed(Sprite* sprite, const Transform& transform, Sprite::Filter filter)
+	{
+		int32_t x1, y1, x2, y2;
+		if (sprite == nullptr || !_drawing_target || !transformed_bounds(sprite, transform, x1, y1, x2, y2))
+			return;
+
+		if (_tile_renderer && sprite != _drawing_target)
+		{
+			DrawCommand c = { DrawCommand::TRANSFORMED_SPRITE, _pixel_mode, Pixel(), {}, sprite, filter };
+			c.f[0] = transform.a;
+			c.f[1] = transform.b;
+			c.f[2] = transform.c;
+			c.f[3] = transform.d;
+			c.f[4] = transform.tx;
+			c.f[5] = transform.ty;
+			return record(c, x1, y1, x2, y2);
 		}
 
-		t.join();
-		return ReturnCode::OK;
+		flush();
+		mark_dirty(x1, y1, x2, y2);
+		with_mode(_pixel_mode, [&](auto mode) { transform_write(_drawing_target, mode, full_clip(_drawing_target), sprite, transform, filter); });
 	}
 
-	void Engine::set_drawing_target(Sprite* target)
+	void Engine::set_pixel_mode(Pixel::Mode mode)
 	{
-		if (target)
-			_drawing_target = target;
-		else
-			_drawing_target = _default_drawing_target;
+		_pixel_mode = mode;
 	}
 
-	Sprite* Engine::get_drawing_target()
+	bool Engine::on_awake()
 	{
-		return _drawing_target;
+		return false;
 	}
-
-	int32_t Engine::get_drawing_target_width() const
+	bool Engine::on_update(float delta_time)
 	{
-		if (_drawing_target)
-			return _drawing_target->_width;
-		else
-			return 0;
+		return false;
 	}
-
-	int32_t Engine::get_drawing_target_height() const
+	bool Engine::on_destroy()
 	{
-		if (_drawing_target)
-			return _drawing_target->_height;
-		else
-			return 0;
+		return true;
 	}
-
-	bool Engine::is_focused() const
+	bool Engine::on_fixed_update(float step)
 	{
-		return _has_input_focus;
+		return true;
 	}
 
-	ButtonState Engine::get_key(KeyCode key) const
+	bool Engine::update_frame(float delta_time)
 	{
-		return _keyboard_state[key];
+		if (_fixed_timestep > 0.0f)
+		{
+			_step_accumulator += delta_time;
+
+			uint32_t steps = 0;
+			while (_step_accumulator >= _fixed_timestep)
+			{
+				// too far behind, drop the backlog instead of spending the next frame catching up
+				if (steps == _max_fixed_steps)
+				{
+					_step_accumulator = std::fmod(_step_accumulator, _fixed_timestep);
+					break;
+				}
+
+				MELODY_ZONE("on_fixed_update");
+				if (!on_fixed_update(_fixed_timestep))
+					return false;
+				_step_accumulator -= _fixed_timestep;
+				steps++;
+			}
+
+			_interpolation = _step_accumulator / _fixed_timestep;
+		}
+
+		MELODY_ZONE("on_update");
+		return on_update(delta_time);
 	}
 
-	ButtonState Engine::get_mouse(char button) const
+	void Engine::pace_frame()
 	{
-		return _mouse_state[button];
+		if (_frame_rate_limit <= 0.0f)
+			return;
+
+		MELODY_ZONE("pace_frame");
+		auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / _frame_rate_limit));
+		auto now = std::chrono::steady_clock::now();
+
+		// deadlines advance by whole periods so the rate doesn't drift, a frame that ran late starts over from now
+		_frame_deadline += period;
+		if (_frame_deadline <= now)
+		{
+			_frame_deadline = now;
+			return;
+		}
+
+		// sleeps can overshoot by a scheduler tick, so stop short of the deadline and spin the rest
+		auto wake = _frame_deadline - std::chrono::milliseconds(2);
+		if (now < wake)
+			std::this_thread::sleep_until(wake);
+		while (std::chrono::steady_clock::now() < _frame_deadline)
+			std::this_thread::yield();
 	}
 
-	int32_t Engine::get_mouse_x() const
+	// input log, little endian: a header, then per frame the delta_time, the event count and the events
+	struct InputLogHeader
 	{
-		return _mouse_pos_x;
-	}
+		char magic[4];
+		uint32_t version;
+		uint32_t screen_width;
+		uint32_t screen_height;
+	};
 
-	int32_t Engine::get_mouse_y() const
+	struct InputLogFrame
 	{
-		return _mouse_pos_y;
-	}
+		float delta_time;
+		uint32_t event_count;
+	};
 
-	int32_t Engine::get_screen_width() const
+	struct InputLogEvent
 	{
-		return _screen_width;
-	}
+		uint32_t age_us; // how long before the frame started it arrived
+		int16_t x;
+		int16_t y;
+		uint8_t type;
+		uint8_t code;
+		uint16_t reserved;
+	};
 
-	int32_t Engine::get_screen_height() const
+	static const uint32_t INPUT_LOG_VERSION = 1;
+
+	ReturnCode Engine::set_input_recording(std::string file)
 	{
-		return _screen_height;
+		if (_input_record.is_open())
+			_input_record.close();
+		if (file.empty())
+			return ReturnCode::OK;
+
+		_input_record.open(file, std::ios::binary | std::ios::trunc);
+		if (!_input_record.is_open())
+			return ReturnCode::NO_FILE;
+
+		InputLogHeader header = { { 'M', 'R', 'E', 'C' }, INPUT_LOG_VERSION, _screen_width, _screen_height };
+		_input_record.write((const char*)&header, sizeof(header));
+		return ReturnCode::OK;
 	}
 
-	void Engine::draw_pixel(int32_t x, int32_t y, Pixel p)
+	ReturnCode Engine::set_input_replay(std::string file, float fixed_delta_time)
 	{
-		if (!_drawing_target)
-			return;
+		if (_input_replay.is_open())
+			_input_replay.close();
+		if (file.empty())
+			return ReturnCode::OK;
+
+		_input_replay.open(file, std::ios::binary);
+		if (!_input_replay.is_open())
+			return ReturnCode::NO_FILE;
 
-		if (_pixel_mode == Pixel::Mode::NORMAL)
+		// mouse positions are in pixels, so they only mean the same thing on the same screen
+		InputLogHeader header;
+		if (!_input_replay.read((char*)&header, sizeof(header)) || memcmp(header.magic, "MREC", 4) != 0
+			|| header.version != INPUT_LOG_VERSION || header.screen_width != _screen_width || header.screen_height != _screen_height)
 		{
-			_drawing_target->set_pixel(x, y, p);
-			return;
+			_input_replay.close();
+			return ReturnCode::FAIL;
 		}
 
-		if (_pixel_mode == Pixel::Mode::MASK)
+		_replay_delta_time = fixed_delta_time;
+		return ReturnCode::OK;
+	}
+
+	bool Engine::update_input_state(float& delta_time)
+	{
+		MELODY_ZONE("input");
+
+		// only the buttons that changed last frame have flags to clear
+		for (uint32_t i = 0; i < _touched_key_count; i++)
 		{
-			if (p.a != 255)
-				_drawing_target->set_pixel(x, y, p);
-			return;
+			_keyboard_state[_touched_keys[i]].Pressed = false;
+			_keyboard_state[_touched_keys[i]].Released = false;
 		}
+		_touched_key_count = 0;
 
-		if (_pixel_mode == Pixel::Mode::ALPHA)
+		for (int i = 0; i < 5; i++)
 		{
-			Pixel d = _drawing_target->get_pixel(x, y);
-			float a = (float)p.a / 255.0f;
-			float c = 1.0f - a;
-			float r = a * (float)p.r + c * (float)d.r;
-			float g = a * (float)p.g + c * (float)d.g;
-			float b = a * (float)p.b + c * (float)d.b;
-			_drawing_target->set_pixel(x, y, Pixel((uint8_t)r, (uint8_t)g, (uint8_t)b));
-			return;
+			_mouse_state[i].Pressed = false;
+			_mouse_state[i].Released = false;
 		}
-	}
 
-	void Engine::draw_line(int32_t x1, int32_t y1, int32_t x2, int32_t y2, Pixel p)
-	{
-		int x, y, dx, dy, dx1, dy1, px, py, xe, ye, i;
-		dx = x2 - x1; dy = y2 - y1;
-		dx1 = abs(dx); dy1 = abs(dy);
-		px = 2 * dy1 - dx1;	py = 2 * dx1 - dy1;
-		if (dy1 <= dx1)
+		uint64_t now_ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+		// apply every event in order, a press and release between two frames sets both flags
+		_input_events.clear();
+		InputEvent e;
+		if (_input_replay.is_open())
 		{
-			if (dx >= 0)
-			{
-				x = x1; y = y1; xe = x2;
-			}
-			else
+			// live input is drained and dropped so it cannot pile up behind the replay
+			while (_input_queue.pop(e))
+				;
+
+			InputLogFrame frame;
+			if (!_input_replay.read((char*)&frame, sizeof(frame)))
 			{
-				x = x2; y = y2; xe = x1;
+				// the recording is over, whatever runs after this gets live input again
+				_input_replay.close();
+				return false;
 			}
 
-			draw_pixel(x, y, p);
-
-			for (i = 0; x < xe; i++)
+			for (uint32_t i = 0; i < frame.event_count; i++)
 			{
-				x = x + 1;
-				if (px < 0)
-					px = px + 2 * dy1;
-				else
+				InputLogEvent logged;
+				if (!_input_replay.read((char*)&logged, sizeof(logged)))
 				{
-					if ((dx < 0 && dy < 0) || (dx > 0 && dy > 0)) y = y + 1; else y = y - 1;
-					px = px + 2 * (dy1 - dx1);
+					_input_replay.close();
+					return false;
 				}
-				draw_pixel(x, y, p);
+
+				e.type = (InputEvent::Type)logged.type;
+				e.code = logged.code;
+				e.x = logged.x;
+				e.y = logged.y;
+				e.time_ns = now_ns - (uint64_t)logged.age_us * 1000;
+				apply_input(e);
+				_input_events.push_back(e);
 			}
+
+			delta_time = _replay_delta_time > 0.0f ? _replay_delta_time : frame.delta_time;
 		}
 		else
 		{
-			if (dy >= 0)
+			while (_input_queue.pop(e))
 			{
-				x = x1; y = y1; ye = y2;
-			}
-			else
-			{
-				x = x2; y = y2; ye = y1;
+				apply_input(e);
+				_input_events.push_back(e);
 			}
+		}
 
-			draw_pixel(x, y, p);
+		if (_input_record.is_open())
+		{
+			InputLogFrame frame = { delta_time, (uint32_t)_input_events.size() };
+			_input_record.write((const char*)&frame, sizeof(frame));
 
-			for (i = 0; y < ye; i++)
+			for (const InputEvent& r : _input_events)
 			{
-				y = y + 1;
-				if (py <= 0)
-					py = py + 2 * dx1;
-				else
-				{
-					if ((dx < 0 && dy < 0) || (dx > 0 && dy > 0)) x = x + 1; else x = x - 1;
-					py = py + 2 * (dx1 - dy1);
-				}
-				draw_pixel(x, y, p);
+				uint64_t age_us = now_ns > r.time_ns ? (now_ns - r.time_ns) / 1000 : 0;
+				InputLogEvent logged = { (uint32_t)std::min<uint64_t>(age_us, UINT32_MAX), (int16_t)r.x, (int16_t)r.y, (uint8_t)r.type, (uint8_t)r.code, 0 };
+				_input_record.write((const char*)&logged, sizeof(logged));
 			}
 		}
-	}
-
-	void Engine::draw_circle(int32_t x, int32_t y, int32_t radius, Pixel p)
-	{
-		int x0 = 0;
-		int y0 = radius;
-		int d = 3 - 2 * radius;
-		if (!radius) return;
 
-		while (y0 >= x0) // only formulate 1/8 of circle
-		{
-			draw_pixel(x - x0, y - y0, p);//upper left left
-			draw_pixel(x - y0, y - x0, p);//upper upper left
-			draw_pixel(x + y0, y - x0, p);//upper upper right
-			draw_pixel(x + x0, y - y0, p);//upper right right
-			draw_pixel(x - x0, y + y0, p);//lower left left
-			draw_pixel(x - y0, y + x0, p);//lower lower left
-			draw_pixel(x + y0, y + x0, p);//lower lower right
-			draw_pixel(x + x0, y + y0, p);//lower right right
-			if (d < 0) d += 4 * x0++ + 6;
-			else d += 4 * (x0++ - y0--) + 10;
-		}
+		return true;
 	}
 
-	void Engine::fill_circle(int32_t x, int32_t y, int32_t radius, Pixel p)
+	void Engine::apply_input(const InputEvent& e)
 	{
-		// Taken from wikipedia
-		int x0 = 0;
-		int y0 = radius;
-		int d = 3 - 2 * radius;
-		if (!radius) return;
-
-		auto drawline = [&](int sx, int ex, int ny)
-		{
-			for (int i = sx; i <= ex; i++)
-				draw_pixel(i, ny, p);
-		};
-
-		while (y0 >= x0)
+		ButtonState* button = nullptr;
+		bool is_key = e.type == InputEvent::KEY_DOWN || e.type == InputEvent::KEY_UP;
+		if (is_key)
+			button = &_keyboard_state[e.code & 255];
+		else if ((e.type == InputEvent::MOUSE_DOWN || e.type == InputEvent::MOUSE_UP) && e.code < 5)
+			button = &_mouse_state[e.code];
+		bool had_flags = button && (button->Pressed || button->Released);
+
+		switch (e.type)
 		{
-			// Modified to draw scan-lines instead of edges
-			drawline(x - x0, x + x0, y - y0);
-			drawline(x - y0, x + y0, y - x0);
-			drawline(x - x0, x + x0, y + y0);
-			drawline(x - y0, x + y0, y + x0);
-			if (d < 0) d += 4 * x0++ + 6;
-			else d += 4 * (x0++ - y0--) + 10;
+		case InputEvent::KEY_DOWN:
+		case InputEvent::MOUSE_DOWN:
+			if (button)
+			{
+				// key repeat arrives as more downs while held, those are not new presses
+				button->Pressed = button->Pressed || !button->Held;
+				button->Held = true;
+			}
+			break;
+		case InputEvent::KEY_UP:
+		case InputEvent::MOUSE_UP:
+			if (button && button->Held)
+			{
+				button->Released = true;
+				button->Held = false;
+			}
+			break;
+		case InputEvent::MOUSE_MOVE:
+			_mouse_pos_x = e.x;
+			_mouse_pos_y = e.y;
+			break;
+		case InputEvent::FOCUS_GAINED:
+			_has_input_focus = true;
+			break;
+		case InputEvent::FOCUS_LOST:
+			_has_input_focus = false;
+			break;
 		}
+
+		// each key goes on the list once, the first time one of its flags is set this frame
+		if (is_key && !had_flags && (button->Pressed || button->Released))
+			_touched_keys[_touched_key_count++] = (uint8_t)(e.code & 255);
 	}
 
-	void Engine::draw_rect(int32_t x, int32_t y, int32_t w, int32_t h, Pixel p)
+	void Engine::push_input(InputEvent::Type type, uint32_t code, int32_t x, int32_t y)
 	{
-		draw_line(x, y, x + w, y, p);
-		draw_line(x + w, y, x + w, y + h, p);
-		draw_line(x + w, y + h, x, y + h, p);
-		draw_line(x, y + h, x, y, p);
+		InputEvent e;
+		e.type = type;
+		e.code = code;
+		e.x = x;
+		e.y = y;
+		e.time_ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+		// only fills if the game thread stalls for a thousand events, the newest are dropped then
+		_input_queue.push(e);
 	}
 
-	void Engine::fill_rect(int32_t x, int32_t y, int32_t w, int32_t h, Pixel p)
+#ifdef _WIN32
+	void Engine::threading()
 	{
-		int32_t x2 = x + w;
-		int32_t y2 = y + h;
+		MELODY_THREAD_NAME("game");
 
-		if (x < 0) x = 0;
-		if (x >= (int32_t)get_screen_width()) x = (int32_t)get_screen_width();
-		if (y < 0) y = 0;
-		if (y >= (int32_t)get_screen_height()) y = (int32_t)get_screen_height();
+		// presentation runs on its own thread and owns the opengl context
+		_screens.resize(_frames_in_flight + 1);
+		_screens[0].sprite = _default_drawing_target;
+		for (size_t i = 1; i < _screens.size(); i++)
+			_screens[i].sprite = new Sprite(_screen_width, _screen_height);
+		_screen_index = (uint32_t)_screens.size() - 1;
+		_present_quit = false;
 
-		if (x2 < 0) x2 = 0;
-		if (x2 >= (int32_t)get_screen_width()) x2 = (int32_t)get_screen_width();
-		if (y2 < 0) y2 = 0;
-		if (y2 >= (int32_t)get_screen_height()) y2 = (int32_t)get_screen_height();
+		std::thread present = std::thread(&Engine::presenting, this);
 
-		for (int i = x; i < x2; i++)
-			for (int j = y; j < y2; j++)
-				draw_pixel(i, j, p);
-	}
+		// load resources
+		if (!on_awake())
+			_atom_active = false;
 
-	void Engine::draw_triangle(int32_t x1, int32_t y1, int32_t x2, int32_t y2, int32_t x3, int32_t y3, Pixel p)
-	{
-		draw_line(x1, y1, x2, y2, p);
-		draw_line(x2, y2, x3, y3, p);
-		draw_line(x3, y3, x1, y1, p);
-	}
+		// sleeps are only as fine as the system timer, ask for 1ms while frames are being paced
+		bool fine_timer = false;
 
-	void Engine::fill_triangle(int32_t x1, int32_t y1, int32_t x2, int32_t y2, int32_t x3, int32_t y3, Pixel p)
-	{
-		auto SWAP = [](int& x, int& y) { int t = x; x = y; y = t; };
-		auto drawline = [&](int sx, int ex, int ny) { for (int i = sx; i <= ex; i++) draw_pixel(i, ny, p); };
-
-		int t1x, t2x, y, minx, maxx, t1xp, t2xp;
-		bool changed1 = false;
-		bool changed2 = false;
-		int signx1, signx2, dx1, dy1, dx2, dy2;
-		int e1, e2;
-		// Sort vertices
-		if (y1 > y2) { SWAP(y1, y2); SWAP(x1, x2); }
-		if (y1 > y3) { SWAP(y1, y3); SWAP(x1, x3); }
-		if (y2 > y3) { SWAP(y2, y3); SWAP(x2, x3); }
-
-		t1x = t2x = x1; y = y1;   // Starting points
-		dx1 = (int)(x2 - x1); if (dx1 < 0) { dx1 = -dx1; signx1 = -1; }
-		else signx1 = 1;
-		dy1 = (int)(y2 - y1);
-
-		dx2 = (int)(x3 - x1); if (dx2 < 0) { dx2 = -dx2; signx2 = -1; }
-		else signx2 = 1;
-		dy2 = (int)(y3 - y1);
-
-		if (dy1 > dx1) {   // swap values
-			SWAP(dx1, dy1);
-			changed1 = true;
-		}
-		if (dy2 > dx2) {   // swap values
-			SWAP(dy2, dx2);
-			changed2 = true;
-		}
-
-		e2 = (int)(dx2 >> 1);
-		// Flat top, just process the second half
-		if (y1 == y2) goto next;
-		e1 = (int)(dx1 >> 1);
-
-		for (int i = 0; i < dx1;) {
-			t1xp = 0; t2xp = 0;
-			if (t1x < t2x) { minx = t1x; maxx = t2x; }
-			else { minx = t2x; maxx = t1x; }
-			// process first line until y value is about to change
-			while (i < dx1) {
-				i++;
-				e1 += dy1;
-				while (e1 >= dx1) {
-					e1 -= dx1;
-					if (changed1) t1xp = signx1;//t1x += signx1;
-					else          goto next1;
-				}
-				if (changed1) break;
-				else t1x += signx1;
-			}
-			// Move line
-		next1:
-			// process second line until y value is about to change
-			while (1) {
-				e2 += dy2;
-				while (e2 >= dx2) {
-					e2 -= dx2;
-					if (changed2) t2xp = signx2;//t2x += signx2;
-					else          goto next2;
-				}
-				if (changed2)     break;
-				else              t2x += signx2;
-			}
-		next2:
-			if (minx > t1x) minx = t1x; if (minx > t2x) minx = t2x;
-			if (maxx < t1x) maxx = t1x; if (maxx < t2x) maxx = t2x;
-			drawline(minx, maxx, y);    // Draw line from min to max points found on the y
-										// Now increase y
-			if (!changed1) t1x += signx1;
-			t1x += t1xp;
-			if (!changed2) t2x += signx2;
-			t2x += t2xp;
-			y += 1;
-			if (y == y2) break;
-
-		}
-	next:
-		// Second half
-		dx1 = (int)(x3 - x2); if (dx1 < 0) { dx1 = -dx1; signx1 = -1; }
-		else signx1 = 1;
-		dy1 = (int)(y3 - y2);
-		t1x = x2;
-
-		if (dy1 > dx1) {   // swap values
-			SWAP(dy1, dx1);
-			changed1 = true;
-		}
-		else changed1 = false;
-
-		e1 = (int)(dx1 >> 1);
-
-		for (int i = 0; i <= dx1; i++) {
-			t1xp = 0; t2xp = 0;
-			if (t1x < t2x) { minx = t1x; maxx = t2x; }
-			else { minx = t2x; maxx = t1x; }
-			// process first line until y value is about to change
-			while (i < dx1) {
-				e1 += dy1;
-				while (e1 >= dx1) {
-					e1 -= dx1;
-					if (changed1) { t1xp = signx1; break; }//t1x += signx1;
-					else          goto next3;
+		auto time_point1 = std::chrono::steady_clock::now();
+		auto time_point2 = time_point1;
+		_frame_deadline = time_point1;
+
+		while (_atom_active)
+		{
+			// as fast as possible unless capped or held back by vsync
+			while (_atom_active)
+			{
+				// the cap can be set or lifted from on_update, so the timer follows it every frame
+				bool capped = _frame_rate_limit > 0.0f;
+				if (capped && !fine_timer)
+					fine_timer = timeBeginPeriod(1) == TIMERR_NOERROR;
+				else if (!capped && fine_timer)
+				{
+					timeEndPeriod(1);
+					fine_timer = false;
 				}
-				if (changed1) break;
-				else   	   	  t1x += signx1;
-				if (i < dx1) i++;
-			}
-		next3:
-			// process second line until y value is about to change
-			while (t2x != x3) {
-				e2 += dy2;
-				while (e2 >= dx2) {
-					e2 -= dx2;
-					if (changed2) t2xp = signx2;
-					else          goto next4;
+
+				pace_frame();
+
+				time_point2 = std::chrono::steady_clock::now();
+				std::chrono::duration<float> elapsed_time = time_point2 - time_point1;
+				time_point1 = time_point2;
+
+				float delta_time = elapsed_time.count();
+
+				// draw into a screen buffer the present thread is done with
+				acquire_screen();
+
+				FrameTimings timings = {};
+				timings.phase[FrameStats::FRAME] = delta_time;
+
+				auto time_phase = std::chrono::steady_clock::now();
+				if (!update_input_state(delta_time))
+				{
+					_atom_active = false;
+					break;
 				}
-				if (changed2)     break;
-				else              t2x += signx2;
-			}
-		next4:
+				auto time_input = std::chrono::steady_clock::now();
+				timings.phase[FrameStats::INPUT] = std::chrono::duration<float>(time_input - time_phase).count();
 
-			if (minx > t1x) minx = t1x; if (minx > t2x) minx = t2x;
-			if (maxx < t1x) maxx = t1x; if (maxx < t2x) maxx = t2x;
-			drawline(minx, maxx, y);
-			if (!changed1) t1x += signx1;
-			t1x += t1xp;
-			if (!changed2) t2x += signx2;
-			t2x += t2xp;
-			y += 1;
-			if (y > y3) return;
-		}
-	}
+				// frame
+				if (!update_frame(delta_time))
+					_atom_active = false;
 
-	void Engine::draw_sprite(int32_t x, int32_t y, Sprite* sprite)
-	{
-		if (sprite == nullptr)
-			return;
+				// finish recorded draw calls before the screen is used
+				flush();
+				composite_layers();
+				update_dirty_rects();
+				timings.phase[FrameStats::UPDATE] = std::chrono::duration<float>(std::chrono::steady_clock::now() - time_input).count();
 
-		for (int i = 0; i < sprite->_width; i++)
-		{
-			for (int j = 0; j < sprite->_height; j++)
+				// hand the frame over, the next one starts while this one is uploaded and presented
+				submit_screen(timings);
+				_frame_count++;
+			}
+
+			if (on_destroy())
+			{
+
+			}
+			else
 			{
-				draw_pixel(x + i, y + j, sprite->get_pixel(i, j));
+				// if abort destroying, continue running
+				_atom_active = true;
 			}
 		}
+
+		// let the present thread drain its queue
+		{
+			std::lock_guard<std::mutex> lock(_present_mutex);
+			_present_quit = true;
+		}
+		_present_signal.notify_all();
+		present.join();
+
+		if (fine_timer)
+			timeEndPeriod(1);
+
+		write_frame_csv();
+		_input_record.close();
+		PostMessage(_hwnd, WM_DESTROY, 0, 0);
 	}
 
-	void Engine::draw_sprite_partial(int32_t x, int32_t y, Sprite* sprite, int32_t ox, int32_t oy, int32_t w, int32_t h)
+	void Engine::acquire_screen()
 	{
-		if (sprite = nullptr)
-			return;
+		uint32_t next = (_screen_index + 1) % (uint32_t)_screens.size();
+		ScreenBuffer& screen = _screens[next];
+
+		{
+			MELODY_ZONE("wait for screen");
+			std::unique_lock<std::mutex> lock(_present_mutex);
+			_present_signal.wait(lock, [&] { return !screen.in_flight; });
+		}
 
-		for (int i = 0; i < w; i++)
+		// bring the buffer up to date with the frames drawn since it was last used,
+		// the other buffers hold exactly those frames' dirty rectangles
+		Sprite* latest = _screens[_screen_index].sprite;
+		if (screen.sprite != latest)
 		{
-			for (int j = 0; j < h; j++)
+			for (uint32_t i = 0; i < (uint32_t)_screens.size(); i++)
 			{
-				draw_pixel(x + i, y + j, sprite->get_pixel(i + ox, j + oy));
+				if (i == next)
+					continue;
+
+				MELODY_ZONE("copy forward");
+				for (const DirtyRect& r : _screens[i].dirty)
+					for (int32_t y = r.y; y < r.y + r.h; y++)
+						memcpy(screen.sprite->get_data() + y * screen.sprite->get_stride() + r.x,
+							latest->get_data() + y * latest->get_stride() + r.x, r.w * sizeof(Pixel));
 			}
 		}
-	}
 
-	void Engine::set_pixel_mode(Pixel::Mode mode)
-	{
-		_pixel_mode = mode;
+		// the primary screen follows the buffer, other drawing targets stay as they are
+		if (_drawing_target == _default_drawing_target)
+			_drawing_target = screen.sprite;
+		_default_drawing_target = screen.sprite;
+		_screen_index = next;
 	}
 
-	bool Engine::on_awake()
-	{
-		return false;
-	}
-	bool Engine::on_update(float delta_time)
-	{
-		return false;
-	}
-	bool Engine::on_destroy()
+	void Engine::submit_screen(const FrameTimings& timings)
 	{
-		return true;
+		{
+			std::lock_guard<std::mutex> lock(_present_mutex);
+			ScreenBuffer& screen = _screens[_screen_index];
+			std::swap(screen.dirty, _dirty_rects);
+			screen.timings = timings;
+			screen.in_flight = true;
+			_present_queue.push_back(_screen_index);
+		}
+		_present_signal.notify_all();
 	}
 
-	void Engine::update_mouse(uint32_t x, uint32_t y)
+	void Engine::presenting()
 	{
-		// come in screen space
-		// leave in pixel space
-		_mouse_pos_x = x / _pixel_width;
-		_mouse_pos_y = y / _pixel_height;
-	}
+		MELODY_THREAD_NAME("present");
 
-	void Engine::threading()
-	{
-		// init opengl, context owned by the game thread
+		// init opengl, context owned by the present thread
 		create_opengl();
 
 		// create screen texture
@@ -593,79 +3674,46 @@ namespace Melody
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 		glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_DECAL);
 
-		// load resources
-		if (!on_awake())
-			_atom_active = false;
-
-		auto time_point1 = std::chrono::system_clock::now();
-		auto time_point2 = std::chrono::system_clock::now();
+		// storage is allocated once, frames only upload their dirty rectangles
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, get_screen_width(), get_screen_height(), 0,
+			GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		// screen rows are padded out to their stride
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, _screens.front().sprite->get_stride());
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
-		while (_atom_active)
+		while (true)
 		{
-			// run afap
-			while (_atom_active)
+			uint32_t index;
 			{
-				time_point2 = std::chrono::system_clock::now();
-				std::chrono::duration<float> elapsed_time = time_point2 - time_point1;
-				time_point1 = time_point2;
-
-				float delta_time = elapsed_time.count();
-
-				// keyboard input
-				for (int i = 0; i < 256; i++)
-				{
-					_keyboard_state[i].Pressed = false;
-					_keyboard_state[i].Released = false;
+				std::unique_lock<std::mutex> lock(_present_mutex);
+				_present_signal.wait(lock, [&] { return !_present_queue.empty() || _present_quit; });
+				if (_present_queue.empty())
+					break;
+				index = _present_queue.front();
+				_present_queue.pop_front();
+			}
 
-					if (_key_new_state[i] != _key_old_state[i])
-					{
-						if (_key_new_state[i])
-						{
-							_keyboard_state[i].Pressed = !_keyboard_state[i].Held;
-							_keyboard_state[i].Held = true;
-						}
-						else
-						{
-							_keyboard_state[i].Released = true;
-							_keyboard_state[i].Held = false;
-						}
-					}
+			// the game thread leaves an in flight buffer alone
+			ScreenBuffer& screen = _screens[index];
 
-					_key_old_state[i] = _key_new_state[i];
-				}
+			auto time_upload = std::chrono::steady_clock::now();
 
-				// mouse input
-				for (int i = 0; i < 5; i++)
+			// copy the changed regions of the pixel array into the texture
+			{
+				MELODY_ZONE("upload");
+				for (const DirtyRect& r : screen.dirty)
 				{
-					_mouse_state[i].Pressed = false;
-					_mouse_state[i].Released = false;
-
-					if (_mouse_new_state[i] != _mouse_old_state[i])
-					{
-						if (_mouse_new_state[i])
-						{
-							_mouse_state[i].Pressed = !_mouse_state[i].Held;
-							_mouse_state[i].Held = true;
-						}
-						else
-						{
-							_mouse_state[i].Released = true;
-							_mouse_state[i].Held = false;
-						}
-					}
-
-					_mouse_old_state[i] = _mouse_new_state[i];
+					glPixelStorei(GL_UNPACK_SKIP_PIXELS, r.x);
+					glPixelStorei(GL_UNPACK_SKIP_ROWS, r.y);
+					glTexSubImage2D(GL_TEXTURE_2D, 0, r.x, r.y, r.w, r.h,
+						GL_RGBA, GL_UNSIGNED_BYTE, screen.sprite->get_data());
 				}
+			}
 
-				// frame
-				if (!on_update(delta_time))
-					_atom_active = false;
-
+			auto time_present = std::chrono::steady_clock::now();
 
-				// TODO: this is a bit slow (especially in debug, but 100x faster in release mode...)
-				// copy pixel array into texture
-				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, get_screen_width(), get_screen_height(), 0,
-					GL_RGBA, GL_UNSIGNED_BYTE, _default_drawing_target->get_data());
+			{
+				MELODY_ZONE("present");
 
 				// display texture on screen
 				glBegin(GL_QUADS);
@@ -677,29 +3725,35 @@ namespace Melody
 
 				// present
 				SwapBuffers(_gl_device_context);
+			}
 
-				// update title text
+			FrameTimings timings = screen.timings;
+			timings.phase[FrameStats::UPLOAD] = std::chrono::duration<float>(time_present - time_upload).count();
+			timings.phase[FrameStats::PRESENT] = std::chrono::duration<float>(std::chrono::steady_clock::now() - time_present).count();
+			record_frame(timings);
+
+			// update title text a few times per second, averaged over the frames in between
+			_title_time += timings.phase[FrameStats::FRAME];
+			_title_frames++;
+			if (_title_time >= 0.25f)
+			{
 				wchar_t title_text[256];
-				swprintf(title_text, 256, L"Melody - %s - FPS: %3.2f", _window_name.c_str(), 1.0f / delta_time);
+				swprintf(title_text, 256, L"Melody - %s - FPS: %3.2f", _window_name.c_str(), (float)_title_frames / _title_time);
 				SetWindowText(_hwnd, title_text);
+				_title_time = 0.0f;
+				_title_frames = 0;
 			}
 
-			if (on_destroy())
-			{
-
-			}
-			else
 			{
-				// if abort destroying, continue running
-				_atom_active = true;
+				std::lock_guard<std::mutex> lock(_present_mutex);
+				screen.in_flight = false;
 			}
+			_present_signal.notify_all();
 		}
 
 		wglDeleteContext(_gl_render_context);
-		PostMessage(_hwnd, WM_DESTROY, 0, 0);
 	}
 
-
 	HWND Engine::create_window()
 	{
 		WNDCLASS wc;
@@ -777,9 +3831,10 @@ namespace Melody
 		if (!(_gl_render_context = wglCreateContext(_gl_device_context))) return false;
 		wglMakeCurrent(_gl_device_context, _gl_render_context);
 
-		// remove Frame cap
+		// frame cap
 		wglSwapInterval = (wglSwapInterval_t*)wglGetProcAddress("wglSwapIntervalEXT");
-		wglSwapInterval(0);
+		if (wglSwapInterval)
+			wglSwapInterval(_vsync ? 1 : 0);
 
 		return true;
 	}
@@ -790,23 +3845,25 @@ namespace Melody
 		switch (uMsg)
 		{
 		case WM_CREATE:		e = (Engine*)((LPCREATESTRUCT)lParam)->lpCreateParams;	return 0;
-		case WM_MOUSEMOVE:	e->update_mouse(LOWORD(lParam), HIWORD(lParam));		return 0;
-		case WM_SETFOCUS:	e->_has_input_focus = true;								return 0;
-		case WM_KILLFOCUS:	e->_has_input_focus = false;							return 0;
-		case WM_KEYDOWN:	e->_key_new_state[_map_keys[wParam]] = true;			return 0;
-		case WM_KEYUP:		e->_key_new_state[_map_keys[wParam]] = false;			return 0;
-		case WM_LBUTTONDOWN:e->_mouse_new_state[0] = true;							return 0;
-		case WM_LBUTTONUP:	e->_mouse_new_state[0] = false;							return 0;
-		case WM_RBUTTONDOWN:e->_mouse_new_state[1] = true;							return 0;
-		case WM_RBUTTONUP:	e->_mouse_new_state[1] = false;							return 0;
-		case WM_MBUTTONDOWN:e->_mouse_new_state[2] = true;							return 0;
-		case WM_MBUTTONUP:	e->_mouse_new_state[2] = false;							return 0;
+		case WM_MOUSEMOVE:	e->push_input(InputEvent::MOUSE_MOVE, 0, LOWORD(lParam) / e->_pixel_width, HIWORD(lParam) / e->_pixel_height); return 0;
+		case WM_SETFOCUS:	e->push_input(InputEvent::FOCUS_GAINED, 0);				return 0;
+		case WM_KILLFOCUS:	e->push_input(InputEvent::FOCUS_LOST, 0);				return 0;
+		case WM_KEYDOWN:	e->push_input(InputEvent::KEY_DOWN, _map_keys[wParam]);	return 0;
+		case WM_KEYUP:		e->push_input(InputEvent::KEY_UP, _map_keys[wParam]);	return 0;
+		case WM_LBUTTONDOWN:e->push_input(InputEvent::MOUSE_DOWN, 0);				return 0;
+		case WM_LBUTTONUP:	e->push_input(InputEvent::MOUSE_UP, 0);					return 0;
+		case WM_RBUTTONDOWN:e->push_input(InputEvent::MOUSE_DOWN, 1);				return 0;
+		case WM_RBUTTONUP:	e->push_input(InputEvent::MOUSE_UP, 1);					return 0;
+		case WM_MBUTTONDOWN:e->push_input(InputEvent::MOUSE_DOWN, 2);				return 0;
+		case WM_MBUTTONUP:	e->push_input(InputEvent::MOUSE_UP, 2);					return 0;
 		case WM_CLOSE:		_atom_active = false;									return 0;
 		case WM_DESTROY:	PostQuitMessage(0);										return 0;
 		}
 		return DefWindowProc(hWnd, uMsg, wParam, lParam);
 	}
 
+#endif
+
 	// singleton
 	std::atomic<bool> Engine::_atom_active{ false };
 	std::map<uint16_t, uint8_t> Engine::_map_keys;
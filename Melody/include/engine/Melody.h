@@ -1,9 +1,11 @@
 ﻿#pragma once
 
+#ifdef _WIN32
 #pragma comment(lib, "user32.lib")
 #pragma comment(lib, "gdi32.lib")
 #pragma comment(lib, "opengl32.lib")
 #pragma comment(lib, "gdiplus.lib")
+#pragma comment(lib, "winmm.lib")
 
 // windows
 #include <Windows.h>
@@ -11,22 +13,33 @@
 
 // opengl extension
 #include <gl/GL.h>
+#endif
 
 // std
 #include <cmath>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
 #include <string>
 #include <iostream>
 #include <chrono>
 #include <vector>
+#include <memory>
 #include <list>
 #include <thread>
 #include <atomic>
+#include <mutex>
 #include <condition_variable>
+#include <type_traits>
+#include <deque>
 #include <fstream>
 #include <map>
 #include <codecvt>
 
+#include "Profiler.h"
+#include "SpscQueue.h"
+
 
 namespace Melody
 {
@@ -44,6 +57,25 @@ namespace Melody
 		bool Held = false;		// Set tru for all frames between pressed and released events
 	};
 
+	struct InputEvent
+	{
+		enum Type
+		{
+			KEY_DOWN,
+			KEY_UP,
+			MOUSE_DOWN,
+			MOUSE_UP,
+			MOUSE_MOVE,
+			FOCUS_GAINED,
+			FOCUS_LOST
+		};
+
+		Type type;
+		uint32_t code;		// Key for keys, 0 - 4 for mouse buttons
+		int32_t x, y;		// mouse position in pixels
+		uint64_t time_ns;	// steady clock, when the window received it
+	};
+
 	enum KeyCode
 	{
 		A, B, C, D, E, F, G, H, I, J, K, L, M, N, O, P, Q, R, S, T, U, V, W, X, Y, Z,
@@ -89,17 +121,55 @@ namespace Melody
 		MAGENTA(255, 0, 255), DARK_MAGENTA(128, 0, 128), VERY_DARK_MAGENTA(64, 0, 64),
 		BLACK(0, 0, 0);
 
+	// alpha blend kernels, 8 bit fixed point with exact rounding
+	// colour: s * a + d * (1 - a), alpha: s.a + d.a * (1 - s.a)
+	// rows are processed 8 (avx2) or 4 (sse2) pixels at a time, define MELODY_NO_SIMD to force scalar code
+	Pixel blend_pixel(Pixel d, Pixel s);
+	void blend_row(Pixel* dst, const Pixel* src, int32_t count);
+	void blend_fill(Pixel* dst, Pixel src, int32_t count);
+	// the same for sources whose colour is already multiplied by their alpha, s + d * (1 - s.a) on every channel.
+	// a multiply per channel cheaper, and within one step of blend_pixel on the straight colour
+	Pixel blend_premultiplied_pixel(Pixel d, Pixel s);
+	void blend_premultiplied_row(Pixel* dst, const Pixel* src, int32_t count);
+
+	class PixelPool;
+	class TileRenderer;
+
 	class Sprite
 	{
 	public:
 		Sprite();
 		Sprite(std::string image_file);
 		Sprite(int32_t w, int32_t h);
+		// takes its pixels from the pool and gives them back when it dies, for scratch targets made every frame
+		Sprite(int32_t w, int32_t h, PixelPool* pool);
+		// wraps pixels owned by someone else, such as a mapped sprite pack, they are never freed
+		Sprite(int32_t w, int32_t h, Pixel* data, int32_t stride = 0);
 		~Sprite();
 
+		// moving hands the pixels over, copying is not allowed as both would free them
+		Sprite(Sprite&& other) noexcept;
+		Sprite& operator=(Sprite&& other) noexcept;
+		Sprite(const Sprite&) = delete;
+		Sprite& operator=(const Sprite&) = delete;
+
 	public:
 		ReturnCode load_from_file(std::string image_file);
 
+		enum Filter
+		{
+			NEAREST,	// closest pixel
+			BILINEAR	// weighted between the four closest pixel centres
+		};
+
+		enum Flip
+		{
+			FLIP_NONE = 0,
+			FLIP_HORIZONTAL = 1,
+			FLIP_VERTICAL = 2,
+			FLIP_BOTH = 3
+		};
+
 	public:
 		int32_t _width = 0;
 		int32_t _height = 0;
@@ -107,27 +177,209 @@ namespace Melody
 	public:
 		Pixel get_pixel(int32_t x, int32_t y) const;
 		void set_pixel(int32_t x, int32_t y, Pixel p);
-		Pixel sample(float x, float y) const;
+		// x and y are 0 - 1 across the sprite
+		Pixel sample(float x, float y, Filter filter = NEAREST) const;
+		// rows are get_stride() pixels apart, sprites that allocate their own start every row on 64 bytes
 		Pixel* get_data() const;
+		int32_t get_stride() const;
+
+		// multiplies every colour by its alpha, once after loading. alpha mode draws then blend with a multiply
+		// per channel less, and bilinear filtering no longer bleeds the colour of transparent pixels.
+		// get_pixel, get_data and normal mode draws see the premultiplied values
+		void premultiply();
+		// back to straight alpha, colours of transparent pixels are lost
+		void unpremultiply();
+		bool is_premultiplied() const;
+
+	private:
+		void allocate(int32_t w, int32_t h, PixelPool* pool);
+		void release();
+		// runs recorded tiled draws that read or write this sprite before it is changed or handed out
+		void settle() const;
 
 	private:
 		Pixel* _color_data = nullptr;
+		int32_t _stride = 0;
+		PixelPool* _pool = nullptr;
+		bool _owns_data = true;
+		bool _premultiplied = false;
+		// the tile renderer holding draws that use this sprite, until it executes them
+		mutable TileRenderer* _reader = nullptr;
+
+		friend class PlanarSprite;
+		friend class TileRenderer;
+		friend class SpritePack;
+	};
+
+	// a sprite stored as one plane per channel, for offline image processing where each channel is worked
+	// on separately and 16 pixels fit one simd register. load it from a sprite and store it back to draw it
+	class PlanarSprite
+	{
+	public:
+		PlanarSprite();
+		PlanarSprite(int32_t w, int32_t h);
+		explicit PlanarSprite(const Sprite& sprite);
+		~PlanarSprite();
+
+		PlanarSprite(PlanarSprite&& other) noexcept;
+		PlanarSprite& operator=(PlanarSprite&& other) noexcept;
+		PlanarSprite(const PlanarSprite&) = delete;
+		PlanarSprite& operator=(const PlanarSprite&) = delete;
+
+		enum Channel
+		{
+			RED,
+			GREEN,
+			BLUE,
+			ALPHA
+		};
+
+	public:
+		int32_t _width = 0;
+		int32_t _height = 0;
+
+	public:
+		// rows are get_stride() bytes apart and start on 64 bytes
+		uint8_t* get_plane(Channel channel) const;
+		int32_t get_stride() const;
+
+		// resizes to the sprite and splits its pixels
+		void load(const Sprite& sprite);
+		// interleaves the planes back into a sprite of the same size, FAIL if the sizes differ
+		ReturnCode store(Sprite& sprite) const;
+
+		// the same conversion as Sprite::premultiply, a plane at a time
+		void premultiply();
+		bool is_premultiplied() const;
+
+	private:
+		void allocate(int32_t w, int32_t h);
+		void release();
+
+	private:
+		uint8_t* _data = nullptr;
+		int32_t _stride = 0;
+		bool _premultiplied = false;
+	};
+
+	// keeps the pixel buffers of dead sprites to hand out again at the same size
+	class PixelPool
+	{
+	public:
+		PixelPool();
+		// every sprite made from the pool has to be gone by now
+		~PixelPool();
+
+		PixelPool(const PixelPool&) = delete;
+		PixelPool& operator=(const PixelPool&) = delete;
+
+	public:
+		Pixel* allocate(size_t count);
+		void release(Pixel* data, size_t count);
+
+		// frees every buffer waiting to be reused
+		void trim();
+		size_t get_cached_bytes() const;
+
+	private:
+		std::map<size_t, std::vector<Pixel*>> _free;
+		size_t _cached_bytes = 0;
+		mutable std::mutex _mutex;
 	};
 
+	// 2d affine transform, maps (x, y) to (a * x + c * y + tx, b * x + d * y + ty)
+	struct Transform
+	{
+		float a = 1.0f, b = 0.0f;
+		float c = 0.0f, d = 1.0f;
+		float tx = 0.0f, ty = 0.0f;
+
+		static Transform translate(float x, float y);
+		static Transform rotate(float radians);
+		static Transform scale(float sx, float sy);
+		static Transform shear(float sx, float sy);
+
+		// applies other first, then this, so translate(x, y) * rotate(r) spins in place and then moves
+		Transform operator*(const Transform& other) const;
+		// the identity if this one flattens everything onto a line
+		Transform inverse() const;
+		void apply(float x, float y, float& out_x, float& out_y) const;
+	};
+
+	// triangle corner for the shaded and textured fills, integer x, y are pixel centres
+	struct Vertex
+	{
+		float x = 0.0f, y = 0.0f;
+		float u = 0.0f, v = 0.0f;	// 0 - 1 across the sprite
+		Pixel color = WHITE;		// multiplies the sprite when textured
+	};
+
+	struct FrameStats
+	{
+		enum Phase
+		{
+			INPUT,		// input state update
+			UPDATE,		// on_update and finishing its draw calls
+			UPLOAD,		// screen texture upload
+			PRESENT,	// drawing the screen quad and swapping buffers
+			FRAME,		// time since the previous frame started
+			PHASE_COUNT
+		};
+
+		// seconds, over the recorded frame history
+		float min = 0.0f;
+		float avg = 0.0f;
+		float p50 = 0.0f;
+		float p95 = 0.0f;
+		float p99 = 0.0f;
+		float max = 0.0f;
+	};
+
+	struct DrawCommand;
 
 	class Engine
 	{
 	public:
 		Engine();
+		virtual ~Engine();
 
 	public:
 		ReturnCode construct(uint32_t screen_w, uint32_t screen_h, uint32_t pixel_w, uint32_t pixel_h);
 		ReturnCode Start();
+		// run the game loop without a window or gpu, drawing into the primary screen only
+		// frame_count = 0 runs until on_update returns false
+		// fixed_delta_time = 0 feeds the measured frame time, otherwise the given step
+		ReturnCode start_headless(uint32_t frame_count = 0, float fixed_delta_time = 0.0f);
 
 	public: // game override interface
 		virtual bool on_awake();
 		virtual bool on_update(float delta_time);
 		virtual bool on_destroy();
+		// called in steps of exactly the fixed timestep before on_update, see set_fixed_timestep
+		virtual bool on_fixed_update(float step);
+
+	public: // presentation
+		// frames the present thread may still be uploading while on_update draws the next one (0 - 2),
+		// each one costs a screen sized buffer and the primary screen sprite rotates between them,
+		// so don't hold on to it across frames. call before Start(), has no effect headless.
+		void set_frames_in_flight(uint32_t frames);
+
+	public: // timing
+		// step > 0 runs on_fixed_update in steps of exactly that size before each on_update, zero or
+		// more per frame, and drops time beyond max_steps per frame so a stall can't snowball.
+		// on_update still runs once per frame with the measured time, get_interpolation() is how far
+		// it is between the last step and the next one. 0 turns the fixed steps off
+		void set_fixed_timestep(float step, uint32_t max_steps = 8);
+		float get_interpolation() const;
+		// hold frames to at most fps per second, sleeping most of the wait and spinning the rest. 0 for no cap
+		void set_frame_rate_limit(float fps);
+		// wait for the display refresh on swap, call before Start(). has no effect headless
+		void set_vsync(bool enable);
+
+	public: // statistics
+		// keep per phase timings of the last frames, csv_file receives them at shutdown if given
+		void set_frame_history(uint32_t frames, std::string csv_file = "");
+		FrameStats get_frame_stats(FrameStats::Phase phase) const;
 
 	public: // input
 		bool is_focused() const;
@@ -135,6 +387,16 @@ namespace Melody
 		ButtonState get_mouse(char button) const;
 		int32_t get_mouse_x() const;
 		int32_t get_mouse_y() const;
+		// everything that happened since the previous frame in the order it happened
+		const std::vector<InputEvent>& get_input_events() const;
+
+	public: // record and replay
+		// write the input events and delta_time of every frame to file until the loop ends
+		ReturnCode set_input_recording(std::string file);
+		// feed every frame from a recording instead of live input and stop when it runs out,
+		// fixed_delta_time > 0 replaces the recorded timesteps. call after construct(),
+		// start_headless() then replays as fast as possible without presenting
+		ReturnCode set_input_replay(std::string file, float fixed_delta_time = 0.0f);
 
 	public: // util
 		int32_t get_screen_width() const;
@@ -142,21 +404,84 @@ namespace Melody
 		int32_t get_drawing_target_width() const;
 		int32_t get_drawing_target_height() const;
 		Sprite* get_drawing_target();
+		uint64_t get_frame_count() const;
+		uint32_t get_dirty_area() const; // pixels of the primary screen uploaded for the last frame
+		// mark part of the primary screen as changed, for writes that bypass the draw routines
+		void invalidate(int32_t x, int32_t y, int32_t w, int32_t h);
+		float get_headless_fps() const;
 
 	public: // draw routine
 		void set_drawing_target(Sprite* target); // pass null to specify the primary screen
 		void set_pixel_mode(Pixel::Mode mode);
 
+		// every other primitive writes the drawing target directly with its loops built for the pixel mode,
+		// an override only sees direct calls
 		virtual void draw_pixel(int32_t x, int32_t y, Pixel p);
+		// clipped to the drawing target before it is walked, so off screen parts cost nothing
 		void draw_line(int32_t x1, int32_t y1, int32_t x2, int32_t y2, Pixel p);
+		// anti-aliased with subpixel end points, integer coordinates are pixel centres.
+		// always blended whatever the pixel mode, p.a is scaled by how much of each pixel the line covers
+		void draw_line_aa(float x1, float y1, float x2, float y2, Pixel p);
+		// count points as x, y pairs joined in order, closed joins the last one back to the first.
+		// shared points are drawn once, so translucent joins don't come out darker
+		void draw_polyline(const int32_t* points, uint32_t count, Pixel p, bool closed = false);
+		// count separate segments as x1, y1, x2, y2
+		void draw_lines(const int32_t* segments, uint32_t count, Pixel p);
 		void draw_circle(int32_t x, int32_t y, int32_t radius, Pixel p);
 		void fill_circle(int32_t x, int32_t y, int32_t radius, Pixel p);
 		void draw_rect(int32_t x, int32_t y, int32_t w, int32_t h, Pixel p);
 		void fill_rect(int32_t x, int32_t y, int32_t w, int32_t h, Pixel p);
 		void draw_triangle(int32_t x1, int32_t y1, int32_t x2, int32_t y2, int32_t x3, int32_t y3, Pixel p);
+		// pixel centres inside the triangle, an edge shared by two triangles is filled by one of them only
 		void fill_triangle(int32_t x1, int32_t y1, int32_t x2, int32_t y2, int32_t x3, int32_t y3, Pixel p);
+		// colour blended between the corners
+		void fill_triangle(const Vertex& v1, const Vertex& v2, const Vertex& v3);
+		// sprite mapped across the triangle by the corners' u, v and tinted by their colour
+		void fill_triangle(const Vertex& v1, const Vertex& v2, const Vertex& v3, Sprite* sprite, Sprite::Filter filter = Sprite::NEAREST);
+		// triangles over shared corners, three indices each. corners are moved by transform once however many
+		// triangles share them, and the sprite if given is mapped across by their u, v
+		void draw_mesh(const Vertex* vertices, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count,
+			const Transform& transform = Transform(), Sprite* sprite = nullptr, Sprite::Filter filter = Sprite::NEAREST);
 		void draw_sprite(int32_t x, int32_t y, Sprite* sprite);
+		// every sprite pixel becomes a scale * scale block, for pixel art zoom
+		void draw_sprite(int32_t x, int32_t y, Sprite* sprite, int32_t scale, Sprite::Flip flip = Sprite::FLIP_NONE);
+		// stretched or squashed to w * h with nearest neighbour sampling
+		void draw_sprite(int32_t x, int32_t y, Sprite* sprite, int32_t w, int32_t h, Sprite::Flip flip = Sprite::FLIP_NONE);
 		void draw_sprite_partial(int32_t x, int32_t y, Sprite* sprite, int32_t ox, int32_t oy, int32_t w, int32_t h);
+		// sprite point (x, y) lands on transform.apply(x, y) in the drawing target, for rotated, scaled and sheared sprites.
+		// each target row is mapped back into the sprite once and then stepped across in fixed point
+		void draw_sprite_transformed(Sprite* sprite, const Transform& transform, Sprite::Filter filter = Sprite::NEAREST);
+
+	public: // multithreaded rendering
+		// record draw calls and rasterize them in screen tiles on a pool of worker threads,
+		// results match immediate drawing exactly. thread_count = 0 uses every hardware thread.
+		// draw_pixel overrides only see direct calls while this is on.
+		// sprites are read when the draws run, not when they are recorded. destroying, moving, reloading or
+		// premultiplying a sprite and get_pixel, sample, set_pixel and get_data run the recorded draws that use it
+		// first, so reads see every earlier draw and draws see the sprite as it was when they were recorded.
+		// pixels read or written through a pointer kept from an earlier get_data are not noticed, flush first
+		void set_tiled_rendering(bool enable, uint32_t thread_count = 0, int32_t tile_size = 64);
+		// run recorded draw calls now, the sprite accessors above already do this for the sprites they touch
+		void flush();
+
+	public: // layers
+		// count screen sized layers, composited bottom first into the primary screen at the end of every frame.
+		// only the cells where a shown layer changed are composited again, on a pool of thread_count threads
+		// (0 uses every hardware thread), the rest of the screen keeps the last frame's composite.
+		// layers start transparent, visible and in alpha mode, 0 turns them off. call after construct()
+		void set_layer_count(uint32_t count, uint32_t thread_count = 0);
+		uint32_t get_layer_count() const;
+		// null past the last layer
+		Sprite* get_layer(uint32_t index);
+		// set_drawing_target for a layer, draws into it mark its cells for compositing
+		void set_drawing_layer(uint32_t index);
+		void set_layer_visible(uint32_t index, bool visible);
+		// how the layer is written over the ones below, the bottom layer goes over black
+		void set_layer_mode(uint32_t index, Pixel::Mode mode);
+		// back to transparent, only the cells drawn into since the last clear are touched
+		void clear_layer(uint32_t index);
+		// mark part of a layer as changed, for writes that bypass the draw routines
+		void invalidate_layer(uint32_t index, int32_t x, int32_t y, int32_t w, int32_t h);
 
 	public:
 		std::string _app_name;
@@ -172,17 +497,105 @@ namespace Melody
 		uint32_t _mouse_pos_x = 0;
 		uint32_t _mouse_pos_y = 0;
 		bool _has_input_focus = false;
+		uint64_t _frame_count = 0;
+		uint32_t _frames_in_flight = 1;
+		float _headless_fps = 0.0f;
+
+		float _fixed_timestep = 0.0f;
+		uint32_t _max_fixed_steps = 8;
+		float _step_accumulator = 0.0f;
+		float _interpolation = 0.0f;
+		float _frame_rate_limit = 0.0f;
+		std::chrono::steady_clock::time_point _frame_deadline;
+		bool _vsync = false;
 
 		static std::map<uint16_t, uint8_t> _map_keys;
 
-		bool _key_new_state[256]{ 0 };
-		bool _key_old_state[256]{ 0 };
 		ButtonState _keyboard_state[256];
-
-		bool _mouse_new_state[5]{ 0 };
-		bool _mouse_old_state[5]{ 0 };
 		ButtonState _mouse_state[5];
 
+		// the window thread pushes, the game thread drains it once per frame
+		SpscQueue<InputEvent, 1024> _input_queue;
+		std::vector<InputEvent> _input_events;
+		// keys whose Pressed or Released flag is set, cleared at the start of the next frame
+		uint8_t _touched_keys[256];
+		uint32_t _touched_key_count = 0;
+
+		std::ofstream _input_record;
+		std::ifstream _input_replay;
+		float _replay_delta_time = 0.0f;
+
+		// ring buffer of frame timings, written by whichever thread finishes the frame
+		struct FrameTimings
+		{
+			float phase[FrameStats::PHASE_COUNT];
+		};
+
+		std::vector<FrameTimings> _frame_history;
+		uint32_t _frame_history_size = 1024;
+		uint64_t _frames_recorded = 0;
+		std::string _frame_csv_file;
+		mutable std::mutex _stats_mutex;
+		void record_frame(const FrameTimings& timings);
+		void write_frame_csv() const;
+
+		// changed regions of the primary screen, tracked in cells and merged into rectangles per frame
+		struct DirtyRect
+		{
+			int32_t x, y, w, h;
+		};
+
+		static const int32_t DIRTY_CELL = 32;
+		std::vector<uint8_t> _dirty_cells;
+		int32_t _dirty_cells_x = 0;
+		int32_t _dirty_cells_y = 0;
+		std::vector<DirtyRect> _dirty_rects;
+		uint32_t _dirty_area = 0;
+		void mark_dirty(int32_t bx1, int32_t by1, int32_t bx2, int32_t by2);
+		void mark_cells(std::vector<uint8_t>& cells, int32_t bx1, int32_t by1, int32_t bx2, int32_t by2);
+		void update_dirty_rects();
+
+		// cells are on the same grid as the primary screen's
+		struct Layer
+		{
+			Sprite* sprite = nullptr;
+			Pixel::Mode mode = Pixel::Mode::ALPHA;
+			bool visible = true;
+			bool was_visible = false; // at the last composite, so hiding a layer still redraws where it was
+			std::vector<uint8_t> changed; // since the last composite
+			std::vector<uint8_t> used; // since the last clear
+		};
+		std::vector<Layer> _layers;
+		int32_t _drawing_layer = -1;
+		TileRenderer* _layer_compositor = nullptr;
+		// redraw the changed cells of the primary screen from the layers
+		void composite_layers();
+
+		TileRenderer* _tile_renderer = nullptr;
+		void record(const DrawCommand& c, int32_t bx1, int32_t by1, int32_t bx2, int32_t by2);
+
+		// a line that may leave out its end pixels, for joining segments
+		void draw_segment(int32_t x1, int32_t y1, int32_t x2, int32_t y2, Pixel p, bool skip_start, bool skip_end);
+		// sprite is null for colour only
+		void fill_shaded_triangle(const Vertex& v1, const Vertex& v2, const Vertex& v3, const Sprite* sprite, Sprite::Filter filter);
+		// mesh corners after the transform, kept to reuse the allocation
+		std::vector<Vertex> _mesh_vertices;
+
+		// flag for shutting down
+		static std::atomic<bool> _atom_active;
+
+		// shared by the windowed and headless loops
+		// false once a replay has run out, delta_time is replaced while replaying
+		bool update_input_state(float& delta_time);
+		void apply_input(const InputEvent& e);
+		// fixed steps then on_update, false when the game asks to stop
+		bool update_frame(float delta_time);
+		// wait out the rest of the frame when the frame rate is capped
+		void pace_frame();
+		// window thread side, timestamps the event and queues it for the next frame
+		void push_input(InputEvent::Type type, uint32_t code, int32_t x = 0, int32_t y = 0);
+
+#ifdef _WIN32
 		HDC _gl_device_context = nullptr;
 		HGLRC _gl_render_context = nullptr;
 
@@ -190,11 +603,29 @@ namespace Melody
 
 		void threading();
 
-		// flag for shutting down
-		static std::atomic<bool> _atom_active;
+		// pipelined presentation, the game thread draws into one screen buffer while
+		// the present thread uploads and swaps the ones queued before it
+		struct ScreenBuffer
+		{
+			Sprite* sprite = nullptr;
+			std::vector<DirtyRect> dirty; // changed by the last frame drawn into it
+			FrameTimings timings;
+			bool in_flight = false;
+		};
+
+		std::vector<ScreenBuffer> _screens;
+		uint32_t _screen_index = 0;
+		std::deque<uint32_t> _present_queue;
+		std::mutex _present_mutex;
+		std::condition_variable _present_signal;
+		bool _present_quit = false;
+		float _title_time = 0.0f;
+		uint32_t _title_frames = 0;
+
+		void presenting();
+		void acquire_screen();
+		void submit_screen(const FrameTimings& timings);
 
-		// initialization
-		void update_mouse(uint32_t x, uint32_t y);
 		bool create_opengl();
 
 		// windows bs
@@ -202,5 +633,6 @@ namespace Melody
 		HWND create_window();
 		std::wstring _window_name;
 		static LRESULT CALLBACK window_event(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
+#endif
 	};
 }
\ No newline at end of file
@@ -0,0 +1,155 @@
+#include "Profiler.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Melody
+{
+	namespace Profiler
+	{
+		struct ZoneEvent
+		{
+			const char* name;
+			uint64_t start_ns;
+			uint64_t end_ns;
+		};
+
+		// written only by its own thread; count is published after the event so a
+		// reader sees complete events without taking a lock on the hot path
+		struct ThreadBuffer
+		{
+			uint32_t id = 0;
+			const char* name = nullptr;
+			std::vector<ZoneEvent> events;
+			std::atomic<uint32_t> count{ 0 };
+		};
+
+		static std::atomic<bool> _enabled{ true };
+		static std::atomic<uint32_t> _thread_capacity{ 1 << 16 };
+		static const auto _epoch = std::chrono::steady_clock::now();
+
+		// registration only happens once per thread
+		static std::mutex _registry_mutex;
+		static std::vector<std::unique_ptr<ThreadBuffer>> _registry;
+
+		static ThreadBuffer* thread_buffer()
+		{
+			static thread_local ThreadBuffer* buffer = nullptr;
+			if (!buffer)
+			{
+				std::unique_ptr<ThreadBuffer> b(new ThreadBuffer());
+				b->events.resize(_thread_capacity.load(std::memory_order_relaxed));
+
+				std::lock_guard<std::mutex> lock(_registry_mutex);
+				b->id = (uint32_t)_registry.size() + 1;
+				buffer = b.get();
+				_registry.push_back(std::move(b));
+			}
+			return buffer;
+		}
+
+		void set_enabled(bool enabled)
+		{
+			_enabled.store(enabled, std::memory_order_relaxed);
+		}
+
+		bool is_enabled()
+		{
+			return _enabled.load(std::memory_order_relaxed);
+		}
+
+		void set_thread_capacity(uint32_t events)
+		{
+			_thread_capacity.store(events, std::memory_order_relaxed);
+		}
+
+		void set_thread_name(const char* name)
+		{
+			thread_buffer()->name = name;
+		}
+
+		uint64_t now_ns()
+		{
+			return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _epoch).count();
+		}
+
+		void record(const char* name, uint64_t start_ns, uint64_t end_ns)
+		{
+			if (!_enabled.load(std::memory_order_relaxed))
+				return;
+
+			ThreadBuffer* b = thread_buffer();
+			uint32_t n = b->count.load(std::memory_order_relaxed);
+			if (n >= b->events.size())
+				return;
+
+			b->events[n] = { name, start_ns, end_ns };
+			b->count.store(n + 1, std::memory_order_release);
+		}
+
+		void clear()
+		{
+			std::lock_guard<std::mutex> lock(_registry_mutex);
+			for (auto& b : _registry)
+				b->count.store(0, std::memory_order_release);
+		}
+
+		static void write_json_string(std::ofstream& file, const char* s)
+		{
+			file << '"';
+			for (; s && *s; s++)
+			{
+				if (*s == '"' || *s == '\\')
+					file << '\\';
+				file << *s;
+			}
+			file << '"';
+		}
+
+		bool write_chrome_trace(const std::string& file_name)
+		{
+			std::ofstream file(file_name);
+			if (!file)
+				return false;
+
+			std::lock_guard<std::mutex> lock(_registry_mutex);
+
+			file << std::fixed << std::setprecision(3);
+			file << "{\"traceEvents\":[";
+			bool first = true;
+			auto separator = [&]() { if (!first) file << ",\n"; first = false; };
+
+			for (auto& b : _registry)
+			{
+				if (b->name)
+				{
+					separator();
+					file << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << b->id << ",\"args\":{\"name\":";
+					write_json_string(file, b->name);
+					file << "}}";
+				}
+
+				// complete events, timestamps in microseconds
+				uint32_t count = b->count.load(std::memory_order_acquire);
+				for (uint32_t i = 0; i < count; i++)
+				{
+					const ZoneEvent& e = b->events[i];
+					separator();
+					file << "{\"ph\":\"X\",\"name\":";
+					write_json_string(file, e.name);
+					file << ",\"pid\":1,\"tid\":" << b->id
+						<< ",\"ts\":" << (double)e.start_ns / 1000.0
+						<< ",\"dur\":" << (double)(e.end_ns - e.start_ns) / 1000.0 << "}";
+				}
+			}
+
+			file << "],\"displayTimeUnit\":\"ms\"}\n";
+			return (bool)file;
+		}
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// scoped profiling zones, compiled in when MELODY_PROFILE is defined
+// MELODY_ZONE("name") times the enclosing scope, names must be string literals
+#ifdef MELODY_PROFILE
+#define MELODY_ZONE_CONCAT_(a, b) a##b
+#define MELODY_ZONE_CONCAT(a, b) MELODY_ZONE_CONCAT_(a, b)
+#define MELODY_ZONE(name) Melody::ProfileZone MELODY_ZONE_CONCAT(_melody_zone_, __LINE__)(name)
+#define MELODY_THREAD_NAME(name) Melody::Profiler::set_thread_name(name)
+#else
+#define MELODY_ZONE(name)
+#define MELODY_THREAD_NAME(name)
+#endif
+
+namespace Melody
+{
+	namespace Profiler
+	{
+		// zones are recorded while enabled, on by default
+		void set_enabled(bool enabled);
+		bool is_enabled();
+
+		// events each thread can hold before further zones are dropped, applies to threads that record afterwards
+		void set_thread_capacity(uint32_t events);
+		void set_thread_name(const char* name);
+
+		// chrome trace event json, open in chrome://tracing or ui.perfetto.dev
+		bool write_chrome_trace(const std::string& file);
+		// forget everything recorded so far, only call while no thread is inside a zone
+		void clear();
+
+		uint64_t now_ns();
+		void record(const char* name, uint64_t start_ns, uint64_t end_ns);
+	}
+
+	class ProfileZone
+	{
+	public:
+		ProfileZone(const char* name) : _name(name), _start(Profiler::now_ns()) {}
+		~ProfileZone() { Profiler::record(_name, _start, Profiler::now_ns()); }
+
+		ProfileZone(const ProfileZone&) = delete;
+		ProfileZone& operator=(const ProfileZone&) = delete;
+
+	private:
+		const char* _name;
+		uint64_t _start;
+	};
+}
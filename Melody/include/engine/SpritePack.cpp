@@ -0,0 +1,267 @@
+#include "SpritePack.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Melody
+{
+	static_assert(sizeof(Pixel) == 4, "sprite packs store pixels as 4 bytes");
+
+	SpritePack::SpritePack()
+	{
+	}
+
+	SpritePack::SpritePack(std::string pack_file)
+	{
+		open(pack_file);
+	}
+
+	SpritePack::~SpritePack()
+	{
+		close();
+	}
+
+	ReturnCode SpritePack::open(std::string pack_file)
+	{
+		close();
+
+		if (!map(pack_file))
+			return ReturnCode::NO_FILE;
+
+		// check everything up front so lookups never have to
+		const Header* header = (const Header*)_data;
+		bool valid = _size >= sizeof(Header) && memcmp(header->magic, "MSPK", 4) == 0 && header->version == VERSION
+			&& header->alignment >= alignof(Pixel)
+			&& header->index_offset <= _size && (_size - header->index_offset) / sizeof(Entry) >= header->count
+			&& header->index_offset % alignof(Entry) == 0 && header->names_offset <= _size;
+
+		if (valid)
+		{
+			_entries = (const Entry*)(_data + header->index_offset);
+			_names = (const char*)(_data + header->names_offset);
+
+			for (uint32_t i = 0; i < header->count && valid; i++)
+			{
+				const Entry& e = _entries[i];
+				uint64_t bytes = (uint64_t)(uint32_t)e.width * (uint32_t)e.height * sizeof(Pixel);
+				valid = e.width > 0 && e.height > 0 && e.pixel_offset % alignof(Pixel) == 0
+					&& e.pixel_offset <= _size && bytes <= _size - e.pixel_offset
+					&& (uint64_t)e.name_offset + e.name_length <= _size - header->names_offset;
+			}
+		}
+
+		if (!valid)
+		{
+			close();
+			return ReturnCode::FAIL;
+		}
+
+		// no pixels are touched here, pages fault in the first time a sprite is drawn
+		_sprites.reserve(header->count);
+		for (uint32_t i = 0; i < header->count; i++)
+		{
+			const Entry& e = _entries[i];
+			Sprite* s = new Sprite(e.width, e.height, (Pixel*)(_data + e.pixel_offset));
+			s->_premultiplied = (e.flags & PREMULTIPLIED) != 0;
+			_sprites.push_back(s);
+		}
+
+		return ReturnCode::OK;
+	}
+
+	void SpritePack::close()
+	{
+		for (Sprite* s : _sprites)
+			delete s;
+		_sprites.clear();
+
+		_entries = nullptr;
+		_names = nullptr;
+		unmap();
+	}
+
+	bool SpritePack::is_open() const
+	{
+		return _entries != nullptr;
+	}
+
+	uint32_t SpritePack::get_count() const
+	{
+		return (uint32_t)_sprites.size();
+	}
+
+	std::string SpritePack::get_name(uint32_t index) const
+	{
+		if (index >= _sprites.size())
+			return std::string();
+		return std::string(_names + _entries[index].name_offset, _entries[index].name_length);
+	}
+
+	Sprite* SpritePack::get_sprite(const std::string& name) const
+	{
+		// the index is sorted by name, so a binary search finds it
+		uint32_t lo = 0, hi = (uint32_t)_sprites.size();
+		while (lo < hi)
+		{
+			uint32_t mid = (lo + hi) / 2;
+			const Entry& e = _entries[mid];
+			int32_t c = name.compare(0, std::string::npos, _names + e.name_offset, e.name_length);
+			if (c == 0)
+				return _sprites[mid];
+			if (c < 0)
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+		return nullptr;
+	}
+
+	Sprite* SpritePack::get_sprite(uint32_t index) const
+	{
+		return index < _sprites.size() ? _sprites[index] : nullptr;
+	}
+
+	ReturnCode SpritePack::write(std::string pack_file, const std::vector<std::string>& names, const std::vector<const Sprite*>& sprites)
+	{
+		if (names.size() != sprites.size())
+			return ReturnCode::FAIL;
+
+		uint32_t count = (uint32_t)sprites.size();
+		std::vector<uint32_t> order(count);
+		for (uint32_t i = 0; i < count; i++)
+			order[i] = i;
+		std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return names[a] < names[b]; });
+
+		for (uint32_t i = 1; i < count; i++)
+			if (names[order[i]] == names[order[i - 1]])
+				return ReturnCode::FAIL;
+
+		Header header;
+		memcpy(header.magic, "MSPK", 4);
+		header.version = VERSION;
+		header.count = count;
+		header.alignment = ALIGNMENT;
+		header.index_offset = sizeof(Header);
+		header.names_offset = header.index_offset + (uint64_t)count * sizeof(Entry);
+
+		std::vector<Entry> entries(count);
+		std::string name_blob;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const std::string& name = names[order[i]];
+			entries[i].name_offset = (uint32_t)name_blob.size();
+			entries[i].name_length = (uint32_t)name.size();
+			name_blob += name;
+		}
+
+		uint64_t offset = header.names_offset + name_blob.size();
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const Sprite* s = sprites[order[i]];
+			if (!s || !s->get_data() || s->_width <= 0 || s->_height <= 0)
+				return ReturnCode::FAIL;
+
+			offset = (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+			entries[i].pixel_offset = offset;
+			entries[i].width = s->_width;
+			entries[i].height = s->_height;
+			entries[i].flags = s->is_premultiplied() ? PREMULTIPLIED : 0;
+			offset += (uint64_t)s->_width * s->_height * sizeof(Pixel);
+		}
+
+		std::ofstream file(pack_file, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+			return ReturnCode::NO_FILE;
+
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)entries.data(), entries.size() * sizeof(Entry));
+		file.write(name_blob.data(), name_blob.size());
+
+		static const char padding[ALIGNMENT] = {};
+		uint64_t written = header.names_offset + name_blob.size();
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const Sprite* s = sprites[order[i]];
+			file.write(padding, (std::streamsize)(entries[i].pixel_offset - written));
+
+			// packed rows drop the stride padding
+			for (int32_t y = 0; y < s->_height; y++)
+				file.write((const char*)(s->get_data() + (size_t)y * s->get_stride()), (std::streamsize)s->_width * sizeof(Pixel));
+			written = entries[i].pixel_offset + (uint64_t)s->_width * s->_height * sizeof(Pixel);
+		}
+
+		return file.good() ? ReturnCode::OK : ReturnCode::FAIL;
+	}
+
+	bool SpritePack::map(const std::string& pack_file)
+	{
+#ifdef _WIN32
+		std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+		std::wstring ws_pack_file = converter.from_bytes(pack_file);
+
+		HANDLE file = CreateFileW(ws_pack_file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size) || size.QuadPart == 0 || (uint64_t)size.QuadPart > SIZE_MAX)
+		{
+			CloseHandle(file);
+			return false;
+		}
+
+		// the view keeps the mapping and the file alive once it exists
+		HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+		CloseHandle(file);
+		if (!mapping)
+			return false;
+
+		void* view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+		CloseHandle(mapping);
+		if (!view)
+			return false;
+
+		_data = (uint8_t*)view;
+		_size = (size_t)size.QuadPart;
+		return true;
+#else
+		int fd = ::open(pack_file.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0)
+		{
+			::close(fd);
+			return false;
+		}
+
+		void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (view == MAP_FAILED)
+			return false;
+
+		_data = (uint8_t*)view;
+		_size = (size_t)st.st_size;
+		return true;
+#endif
+	}
+
+	void SpritePack::unmap()
+	{
+		if (!_data)
+			return;
+
+#ifdef _WIN32
+		UnmapViewOfFile(_data);
+#else
+		munmap(_data, _size);
+#endif
+		_data = nullptr;
+		_size = 0;
+	}
+}
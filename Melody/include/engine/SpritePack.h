@@ -0,0 +1,83 @@
+#pragma once
+
+#include "Melody.h"
+
+namespace Melody
+{
+	// many sprites stored pre-decoded in one file, mapped into memory and drawn in place
+	//
+	// layout, little endian:
+	//   header    magic "MSPK", version, sprite count, pixel alignment, index offset, names offset
+	//   index     one entry per sprite sorted by name: pixel offset, width, height, name offset, name length, flags
+	//   names     the names back to back, not terminated
+	//   pixels    each sprite's rows of Pixel, starting on a multiple of the alignment
+	class SpritePack
+	{
+	public:
+		SpritePack();
+		SpritePack(std::string pack_file);
+		~SpritePack();
+
+		SpritePack(const SpritePack&) = delete;
+		SpritePack& operator=(const SpritePack&) = delete;
+
+	public:
+		ReturnCode open(std::string pack_file);
+		// the sprites handed out point into the mapping and are deleted with it
+		void close();
+		bool is_open() const;
+
+		uint32_t get_count() const;
+		std::string get_name(uint32_t index) const;
+		// nullptr if there is no sprite of that name
+		Sprite* get_sprite(const std::string& name) const;
+		Sprite* get_sprite(uint32_t index) const;
+
+		// writes a pack, names must be unique. premultiplied sprites come back premultiplied
+		static ReturnCode write(std::string pack_file, const std::vector<std::string>& names, const std::vector<const Sprite*>& sprites);
+
+	public:
+		static const uint32_t VERSION = 2;
+		static const uint32_t ALIGNMENT = 64;
+
+	private:
+		struct Header
+		{
+			char magic[4];
+			uint32_t version;
+			uint32_t count;
+			uint32_t alignment;
+			uint64_t index_offset;
+			uint64_t names_offset;
+		};
+
+		struct Entry
+		{
+			uint64_t pixel_offset;
+			int32_t width;
+			int32_t height;
+			uint32_t name_offset;
+			uint32_t name_length;
+			uint32_t flags;
+			uint32_t reserved;
+		};
+
+		enum EntryFlags
+		{
+			PREMULTIPLIED = 1	// colours are already multiplied by alpha
+		};
+
+	private:
+		bool map(const std::string& pack_file);
+		void unmap();
+
+	private:
+		// pages are mapped copy on write, drawing into a pack sprite never touches the file
+		uint8_t* _data = nullptr;
+		size_t _size = 0;
+
+		const Entry* _entries = nullptr;
+		const char* _names = nullptr;
+		std::vector<Sprite*> _sprites;
+	};
+}
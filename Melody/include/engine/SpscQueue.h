@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace Melody
+{
+	// bounded lock free queue for exactly one producer thread and one consumer thread
+	template<typename T, uint32_t CAPACITY>
+	class SpscQueue
+	{
+		static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0, "capacity must be a power of two");
+
+	public:
+		// producer only, false if the queue is full
+		bool push(const T& item)
+		{
+			uint32_t tail = _tail.load(std::memory_order_relaxed);
+			if (tail - _head_cache == CAPACITY)
+			{
+				// only look at the consumer's index when the cached one says full
+				_head_cache = _head.load(std::memory_order_acquire);
+				if (tail - _head_cache == CAPACITY)
+					return false;
+			}
+
+			_items[tail & (CAPACITY - 1)] = item;
+			_tail.store(tail + 1, std::memory_order_release);
+			return true;
+		}
+
+		// consumer only, false if the queue is empty
+		bool pop(T& item)
+		{
+			uint32_t head = _head.load(std::memory_order_relaxed);
+			if (head == _tail_cache)
+			{
+				_tail_cache = _tail.load(std::memory_order_acquire);
+				if (head == _tail_cache)
+					return false;
+			}
+
+			item = _items[head & (CAPACITY - 1)];
+			_head.store(head + 1, std::memory_order_release);
+			return true;
+		}
+
+	private:
+		// each side's index and its copy of the other side's sit on their own cache line,
+		// padded rather than aligned so heap allocated owners need no over-aligned new
+		std::atomic<uint32_t> _head{ 0 };
+		uint32_t _tail_cache = 0;
+		uint8_t _consumer_pad[64 - sizeof(std::atomic<uint32_t>) - sizeof(uint32_t)];
+
+		std::atomic<uint32_t> _tail{ 0 };
+		uint32_t _head_cache = 0;
+		uint8_t _producer_pad[64 - sizeof(std::atomic<uint32_t>) - sizeof(uint32_t)];
+
+		T _items[CAPACITY];
+	};
+}
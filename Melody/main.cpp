@@ -1,5 +1,8 @@
 #include "engine/Melody.h"
 
+#include <cstring>
+#include <cstdlib>
+
 class Test : public Melody::Engine
 {
 public:
@@ -24,11 +27,30 @@ public:
 	}
 };
 
-int main()
+int main(int argc, char** argv)
 {
 	Test demo;
 	if (demo.construct(256, 240, 4, 4))
-		demo.Start();
+	{
+		// Melody [--record file | --replay file] [--headless [frames]]
+		int arg = 1;
+		if (arg + 1 < argc && strcmp(argv[arg], "--record") == 0)
+		{
+			demo.set_input_recording(argv[arg + 1]);
+			arg += 2;
+		}
+		else if (arg + 1 < argc && strcmp(argv[arg], "--replay") == 0)
+		{
+			if (demo.set_input_replay(argv[arg + 1]) != Melody::ReturnCode::OK)
+				return 1;
+			arg += 2;
+		}
+
+		if (arg < argc && strcmp(argv[arg], "--headless") == 0)
+			demo.start_headless(arg + 1 < argc ? (uint32_t)atoi(argv[arg + 1]) : 1000);
+		else
+			demo.Start();
+	}
 
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,79 @@
+#include "engine/AssetCache.h"
+#include "engine/SpritePack.h"
+
+#include <cstdio>
+#include <cstring>
+
+// builds a sprite pack from images ahead of time, so games map pixels instead of decoding them
+// usage: Packer [--root dir] output.pack image...
+// sprites are named by their path as given, relative to the root
+
+using namespace Melody;
+
+int main(int argc, char** argv)
+{
+	std::string root;
+	std::string output;
+	std::vector<std::string> names;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--root") && i + 1 < argc)
+			root = argv[++i];
+		else if (output.empty())
+			output = argv[i];
+		else
+		{
+			// names always use forward slashes so packs built on any platform look the same
+			std::string name = argv[i];
+			std::replace(name.begin(), name.end(), '\\', '/');
+			names.push_back(name);
+		}
+	}
+
+	if (output.empty() || names.empty())
+	{
+		printf("usage: %s [--root dir] output.pack image...\n", argv[0]);
+		return 1;
+	}
+
+	if (!root.empty() && root.back() != '/' && root.back() != '\\')
+		root += '/';
+
+	// an image named twice is packed once, the pack needs unique names
+	std::sort(names.begin(), names.end());
+	names.erase(std::unique(names.begin(), names.end()), names.end());
+
+	// decode everything on background threads at once
+	AssetCache cache;
+	std::vector<std::shared_future<std::shared_ptr<Sprite>>> loads;
+	for (const std::string& name : names)
+		loads.push_back(cache.load_async(root + name));
+
+	std::vector<std::shared_ptr<Sprite>> loaded;
+	std::vector<const Sprite*> sprites;
+	uint64_t bytes = 0;
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		std::shared_ptr<Sprite> s = loads[i].get();
+		if (!s)
+		{
+			printf("failed to load %s\n", (root + names[i]).c_str());
+			return 1;
+		}
+
+		loaded.push_back(s);
+		sprites.push_back(s.get());
+		bytes += (uint64_t)s->_width * s->_height * sizeof(Pixel);
+	}
+
+	ReturnCode rc = SpritePack::write(output, names, sprites);
+	if (rc != ReturnCode::OK)
+	{
+		printf(rc == ReturnCode::NO_FILE ? "could not write %s\n" : "could not pack %s, are the names unique?\n", output.c_str());
+		return 1;
+	}
+
+	printf("packed %zu sprites, %.1f MB of pixels into %s\n", sprites.size(), (double)bytes / (1024.0 * 1024.0), output.c_str());
+	return 0;
+}